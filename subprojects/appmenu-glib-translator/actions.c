@@ -0,0 +1,398 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "actions.h"
+#include "utils.h"
+
+/* One action group serves all menus of the importer. Actions are not objects: every item id
+ * has a small record, and names like "id-42" or "submenu-42" are parsed back to ids when GTK
+ * asks for them. A record lives while some menu item references it.
+ */
+typedef struct
+{
+	uint id;
+	uint refs;
+	DBusMenuActionType type;
+	bool enabled;
+	bool state;
+	DBusMenuModel *submenu;
+} DBusMenuAction;
+
+struct _DBusMenuActionGroup
+{
+	GObject parent_instance;
+	DBusMenuXml *xml;
+	GHashTable *actions;
+	bool no_reply;
+	int timeout;
+};
+
+static void dbus_menu_action_group_iface_init(GActionGroupInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(DBusMenuActionGroup, dbus_menu_action_group, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_ACTION_GROUP,
+                                              dbus_menu_action_group_iface_init))
+
+static void dbus_menu_action_free(DBusMenuAction *action)
+{
+	g_clear_object(&action->submenu);
+	g_slice_free(DBusMenuAction, action);
+}
+
+static char *dbus_menu_action_name(DBusMenuAction *action)
+{
+	return dbus_menu_action_get_name(action->id, action->type, false);
+}
+
+static const GVariantType *dbus_menu_action_parameter_type(DBusMenuAction *action)
+{
+	if (action->type == DBUS_MENU_ACTION_RADIO)
+		return G_VARIANT_TYPE_STRING;
+	if (action->type == DBUS_MENU_ACTION_SUBMENU)
+		return G_VARIANT_TYPE_BOOLEAN;
+	return NULL;
+}
+
+static const GVariantType *dbus_menu_action_state_type(DBusMenuAction *action)
+{
+	if (action->type == DBUS_MENU_ACTION_RADIO)
+		return G_VARIANT_TYPE_STRING;
+	if (action->type == DBUS_MENU_ACTION_CHECKMARK || action->type == DBUS_MENU_ACTION_SUBMENU)
+		return G_VARIANT_TYPE_BOOLEAN;
+	return NULL;
+}
+
+static GVariant *dbus_menu_action_get_state(DBusMenuAction *action)
+{
+	if (action->type == DBUS_MENU_ACTION_RADIO)
+		return g_variant_ref_sink(
+		    g_variant_new_string(action->state ? DBUS_MENU_ACTION_RADIO_SELECTED
+		                                       : DBUS_MENU_ACTION_RADIO_UNSELECTED));
+	if (action->type == DBUS_MENU_ACTION_CHECKMARK || action->type == DBUS_MENU_ACTION_SUBMENU)
+		return g_variant_ref_sink(g_variant_new_boolean(action->state));
+	return NULL;
+}
+
+// Parses "id-%u" and "submenu-%u" without allocations
+static DBusMenuAction *dbus_menu_action_group_lookup(DBusMenuActionGroup *group,
+                                                     const char *action_name)
+{
+	bool is_submenu = false;
+	if (g_str_has_prefix(action_name, ACTION_PREFIX))
+		action_name += strlen(ACTION_PREFIX);
+	else if (g_str_has_prefix(action_name, SUBMENU_PREFIX))
+	{
+		action_name += strlen(SUBMENU_PREFIX);
+		is_submenu = true;
+	}
+	else
+		return NULL;
+	char *end  = NULL;
+	guint64 id = g_ascii_strtoull(action_name, &end, 10);
+	if (end == action_name || *end != '\0' || id > G_MAXUINT)
+		return NULL;
+	DBusMenuAction *action =
+	    (DBusMenuAction *)g_hash_table_lookup(group->actions, GUINT_TO_POINTER(id));
+	if (action == NULL || (action->type == DBUS_MENU_ACTION_SUBMENU) != is_submenu)
+		return NULL;
+	return action;
+}
+
+static void dbus_menu_action_group_set_state(DBusMenuActionGroup *group, DBusMenuAction *action,
+                                             bool state)
+{
+	if (action->state == state)
+		return;
+	action->state               = state;
+	g_autofree char *name       = dbus_menu_action_name(action);
+	g_autoptr(GVariant) variant = dbus_menu_action_get_state(action);
+	g_action_group_action_state_changed(G_ACTION_GROUP(group), name, variant);
+}
+
+static void clicked_sent_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) ret =
+	    g_dbus_proxy_call_finish(G_DBUS_PROXY(source_object), res, &error);
+	if (error != NULL && !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		g_debug("Event \"clicked\" for item %u failed: %s",
+		        GPOINTER_TO_UINT(user_data),
+		        error->message);
+}
+
+/* Clicks never wait for the client: an application busy in its main loop must not freeze
+ * the panel. Local state is updated by the caller right away, and the next layout or
+ * property update from the client corrects it if the click was refused.
+ */
+static void dbus_menu_action_group_send_clicked(DBusMenuActionGroup *group, uint id)
+{
+	if (!DBUS_MENU_IS_XML(group->xml))
+		return;
+	// use CURRENT_TIME instead of gtk_get_current_event_time to avoid linking to GTK.
+	g_dbus_proxy_call(G_DBUS_PROXY(group->xml),
+	                  "Event",
+	                  g_variant_new("(isvu)",
+	                                id,
+	                                "clicked",
+	                                g_variant_new_int32(0),
+	                                (guint32)CURRENT_TIME),
+	                  group->no_reply ? G_DBUS_CALL_FLAGS_NO_AUTO_START
+	                                  : G_DBUS_CALL_FLAGS_NONE,
+	                  group->timeout,
+	                  NULL,
+	                  group->no_reply ? NULL : clicked_sent_cb,
+	                  GUINT_TO_POINTER(id));
+}
+
+static void dbus_menu_action_group_change_submenu(DBusMenuActionGroup *group,
+                                                  DBusMenuAction *action, bool request_open)
+{
+	DBusMenuModel *submenu = action->submenu;
+	if (submenu == NULL)
+		return;
+	if (request_open && !action->state)
+	{
+		// Layout is populated when AboutToShow and GetLayout answers arrive
+		dbus_menu_model_open(submenu);
+		dbus_menu_action_group_set_state(group, action, true);
+	}
+	else if (request_open)
+	{
+		if (dbus_menu_model_is_layout_update_required(submenu))
+			dbus_menu_model_update_layout(submenu);
+	}
+	else
+	{
+		dbus_menu_model_close(submenu);
+		dbus_menu_action_group_set_state(group, action, false);
+	}
+}
+
+static gchar **dbus_menu_action_group_list_actions(GActionGroup *action_group)
+{
+	DBusMenuActionGroup *group = DBUS_MENU_ACTION_GROUP(action_group);
+	GPtrArray *names           = g_ptr_array_new();
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, group->actions);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		g_ptr_array_add(names, dbus_menu_action_name((DBusMenuAction *)value));
+	g_ptr_array_add(names, NULL);
+	return (gchar **)g_ptr_array_free(names, false);
+}
+
+static gboolean dbus_menu_action_group_query_action(GActionGroup *action_group,
+                                                    const gchar *action_name, gboolean *enabled,
+                                                    const GVariantType **parameter_type,
+                                                    const GVariantType **state_type,
+                                                    GVariant **state_hint, GVariant **state)
+{
+	DBusMenuActionGroup *group = DBUS_MENU_ACTION_GROUP(action_group);
+	DBusMenuAction *action     = dbus_menu_action_group_lookup(group, action_name);
+	if (action == NULL)
+		return false;
+	if (enabled != NULL)
+		*enabled = action->enabled;
+	if (parameter_type != NULL)
+		*parameter_type = dbus_menu_action_parameter_type(action);
+	if (state_type != NULL)
+		*state_type = dbus_menu_action_state_type(action);
+	if (state_hint != NULL)
+		*state_hint = NULL;
+	if (state != NULL)
+		*state = dbus_menu_action_get_state(action);
+	return true;
+}
+
+static void dbus_menu_action_group_change_action_state(GActionGroup *action_group,
+                                                       const gchar *action_name,
+                                                       GVariant *value)
+{
+	DBusMenuActionGroup *group = DBUS_MENU_ACTION_GROUP(action_group);
+	DBusMenuAction *action     = dbus_menu_action_group_lookup(group, action_name);
+	g_autoptr(GVariant) state  = g_variant_ref_sink(value);
+	const GVariantType *type   = action != NULL ? dbus_menu_action_state_type(action) : NULL;
+	if (type == NULL || !g_variant_is_of_type(state, type))
+		return;
+	if (action->type == DBUS_MENU_ACTION_SUBMENU)
+		dbus_menu_action_group_change_submenu(group, action, g_variant_get_boolean(state));
+	else if (action->type == DBUS_MENU_ACTION_CHECKMARK)
+		dbus_menu_action_group_set_state(group, action, g_variant_get_boolean(state));
+	else
+		dbus_menu_action_group_set_state(group,
+		                                 action,
+		                                 !g_strcmp0(g_variant_get_string(state, NULL),
+		                                            DBUS_MENU_ACTION_RADIO_SELECTED));
+}
+
+static void dbus_menu_action_group_activate_action(GActionGroup *action_group,
+                                                   const gchar *action_name,
+                                                   GVariant *parameter)
+{
+	DBusMenuActionGroup *group        = DBUS_MENU_ACTION_GROUP(action_group);
+	DBusMenuAction *action            = dbus_menu_action_group_lookup(group, action_name);
+	g_autoptr(GVariant) parameter_ref = parameter != NULL ? g_variant_ref_sink(parameter) : NULL;
+	if (action == NULL || !action->enabled)
+		return;
+	switch (action->type)
+	{
+	case DBUS_MENU_ACTION_SUBMENU:
+		dbus_menu_action_group_change_submenu(group,
+		                                      action,
+		                                      parameter_ref != NULL
+		                                          ? g_variant_get_boolean(parameter_ref)
+		                                          : !action->state);
+		break;
+	case DBUS_MENU_ACTION_CHECKMARK:
+		dbus_menu_action_group_send_clicked(group, action->id);
+		dbus_menu_action_group_set_state(group, action, !action->state);
+		break;
+	case DBUS_MENU_ACTION_RADIO:
+		dbus_menu_action_group_send_clicked(group, action->id);
+		if (parameter_ref != NULL && g_variant_is_of_type(parameter_ref, G_VARIANT_TYPE_STRING))
+			dbus_menu_action_group_set_state(group,
+			                                 action,
+			                                 !g_strcmp0(g_variant_get_string(parameter_ref,
+			                                                                 NULL),
+			                                            DBUS_MENU_ACTION_RADIO_SELECTED));
+		break;
+	default:
+		dbus_menu_action_group_send_clicked(group, action->id);
+		break;
+	}
+}
+
+G_GNUC_INTERNAL void dbus_menu_action_group_reference(DBusMenuActionGroup *group, uint id,
+                                                      DBusMenuActionType type,
+                                                      DBusMenuModel *submenu)
+{
+	DBusMenuAction *action =
+	    (DBusMenuAction *)g_hash_table_lookup(group->actions, GUINT_TO_POINTER(id));
+	if (action != NULL && action->type != type)
+	{
+		// Item has changed its kind, so its action is renamed
+		g_autofree char *old_name = dbus_menu_action_name(action);
+		g_action_group_action_removed(G_ACTION_GROUP(group), old_name);
+		g_clear_object(&action->submenu);
+		action->type              = type;
+		action->state             = false;
+		g_autofree char *new_name = dbus_menu_action_name(action);
+		g_action_group_action_added(G_ACTION_GROUP(group), new_name);
+	}
+	else if (action == NULL)
+	{
+		action          = g_slice_new0(DBusMenuAction);
+		action->id      = id;
+		action->type    = type;
+		action->enabled = true;
+		g_hash_table_insert(group->actions, GUINT_TO_POINTER(id), action);
+		g_autofree char *name = dbus_menu_action_name(action);
+		g_action_group_action_added(G_ACTION_GROUP(group), name);
+	}
+	action->refs++;
+	if (submenu != NULL && action->submenu != submenu)
+	{
+		g_clear_object(&action->submenu);
+		action->submenu = g_object_ref(submenu);
+	}
+}
+
+G_GNUC_INTERNAL void dbus_menu_action_group_unreference(DBusMenuActionGroup *group, uint id)
+{
+	DBusMenuAction *action =
+	    (DBusMenuAction *)g_hash_table_lookup(group->actions, GUINT_TO_POINTER(id));
+	if (action == NULL || --action->refs > 0)
+		return;
+	g_autofree char *name = dbus_menu_action_name(action);
+	g_hash_table_remove(group->actions, GUINT_TO_POINTER(id));
+	g_action_group_action_removed(G_ACTION_GROUP(group), name);
+}
+
+G_GNUC_INTERNAL void dbus_menu_action_group_update(DBusMenuActionGroup *group, uint id,
+                                                   bool enabled, bool toggled)
+{
+	DBusMenuAction *action =
+	    (DBusMenuAction *)g_hash_table_lookup(group->actions, GUINT_TO_POINTER(id));
+	if (action == NULL)
+		return;
+	if (action->enabled != enabled)
+	{
+		action->enabled       = enabled;
+		g_autofree char *name = dbus_menu_action_name(action);
+		g_action_group_action_enabled_changed(G_ACTION_GROUP(group), name, enabled);
+	}
+	// Submenu state is opened state, it is changed only by GTK
+	if (action->type == DBUS_MENU_ACTION_CHECKMARK || action->type == DBUS_MENU_ACTION_RADIO)
+		dbus_menu_action_group_set_state(group, action, toggled);
+}
+
+G_GNUC_INTERNAL void dbus_menu_action_group_set_xml(DBusMenuActionGroup *group, DBusMenuXml *xml)
+{
+	g_set_object(&group->xml, xml);
+}
+
+G_GNUC_INTERNAL void dbus_menu_action_group_set_no_reply(DBusMenuActionGroup *group,
+                                                         bool no_reply)
+{
+	group->no_reply = no_reply;
+}
+
+G_GNUC_INTERNAL void dbus_menu_action_group_set_timeout(DBusMenuActionGroup *group, int timeout)
+{
+	group->timeout = timeout;
+}
+
+static void dbus_menu_action_group_iface_init(GActionGroupInterface *iface)
+{
+	iface->list_actions        = dbus_menu_action_group_list_actions;
+	iface->change_action_state = dbus_menu_action_group_change_action_state;
+	iface->activate_action     = dbus_menu_action_group_activate_action;
+	iface->query_action        = dbus_menu_action_group_query_action;
+}
+
+static void dbus_menu_action_group_init(DBusMenuActionGroup *group)
+{
+	group->xml      = NULL;
+	group->no_reply = false;
+	group->timeout  = -1;
+	group->actions  = g_hash_table_new_full(g_direct_hash,
+	                                        g_direct_equal,
+	                                        NULL,
+	                                        (GDestroyNotify)dbus_menu_action_free);
+}
+
+static void dbus_menu_action_group_finalize(GObject *object)
+{
+	DBusMenuActionGroup *group = DBUS_MENU_ACTION_GROUP(object);
+	g_clear_object(&group->xml);
+	g_clear_pointer(&group->actions, g_hash_table_destroy);
+	G_OBJECT_CLASS(dbus_menu_action_group_parent_class)->finalize(object);
+}
+
+static void dbus_menu_action_group_class_init(DBusMenuActionGroupClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize     = dbus_menu_action_group_finalize;
+}
+
+G_GNUC_INTERNAL DBusMenuActionGroup *dbus_menu_action_group_new(void)
+{
+	return DBUS_MENU_ACTION_GROUP(g_object_new(dbus_menu_action_group_get_type(), NULL));
+}
@@ -0,0 +1,48 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ACTIONS_H
+#define ACTIONS_H
+
+#include <gio/gio.h>
+#include <stdbool.h>
+
+#include "dbusmenu-interface.h"
+#include "definitions.h"
+#include "model.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE(DBusMenuActionGroup, dbus_menu_action_group, DBUS_MENU, ACTION_GROUP,
+                     GObject)
+
+G_GNUC_INTERNAL DBusMenuActionGroup *dbus_menu_action_group_new(void);
+G_GNUC_INTERNAL void dbus_menu_action_group_set_xml(DBusMenuActionGroup *group, DBusMenuXml *xml);
+G_GNUC_INTERNAL void dbus_menu_action_group_set_no_reply(DBusMenuActionGroup *group,
+                                                         bool no_reply);
+G_GNUC_INTERNAL void dbus_menu_action_group_set_timeout(DBusMenuActionGroup *group, int timeout);
+G_GNUC_INTERNAL void dbus_menu_action_group_reference(DBusMenuActionGroup *group, uint id,
+                                                      DBusMenuActionType type,
+                                                      DBusMenuModel *submenu);
+G_GNUC_INTERNAL void dbus_menu_action_group_unreference(DBusMenuActionGroup *group, uint id);
+G_GNUC_INTERNAL void dbus_menu_action_group_update(DBusMenuActionGroup *group, uint id,
+                                                   bool enabled, bool toggled);
+
+G_END_DECLS
+
+#endif // ACTIONS_H
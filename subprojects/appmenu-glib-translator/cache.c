@@ -0,0 +1,109 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cache.h"
+
+/* Process-wide cache of last received layouts. Importers are recreated on every window
+ * switch, so a new importer can show a menu at once and then only check that it is still
+ * up to date. Layouts of different depth differ in content, so depth is a part of the key.
+ * Entries are evicted in least recently used order.
+ */
+#define LAYOUT_CACHE_SIZE 64
+
+typedef struct
+{
+	char *key;
+	GVariant *layout;
+	uint revision;
+} DBusMenuCacheEntry;
+
+static GHashTable *cache_index = NULL;
+static GQueue cache_order      = G_QUEUE_INIT;
+
+static void dbus_menu_cache_entry_free(DBusMenuCacheEntry *entry)
+{
+	g_free(entry->key);
+	g_variant_unref(entry->layout);
+	g_free(entry);
+}
+
+static char *dbus_menu_layout_cache_key(const char *bus_name, const char *object_path,
+                                        uint parent_id, int depth)
+{
+	return g_strdup_printf("%s%s/%u:%d", bus_name, object_path, parent_id, depth);
+}
+
+// Returns link to entry, which is moved to the head of LRU queue
+static GList *dbus_menu_layout_cache_touch(const char *key)
+{
+	if (cache_index == NULL)
+		cache_index = g_hash_table_new(g_str_hash, g_str_equal);
+	GList *link = (GList *)g_hash_table_lookup(cache_index, key);
+	if (link != NULL)
+	{
+		g_queue_unlink(&cache_order, link);
+		g_queue_push_head_link(&cache_order, link);
+	}
+	return link;
+}
+
+G_GNUC_INTERNAL GVariant *dbus_menu_layout_cache_lookup(const char *bus_name,
+                                                        const char *object_path, uint parent_id,
+                                                        int depth, uint *revision)
+{
+	if (bus_name == NULL || object_path == NULL)
+		return NULL;
+	g_autofree char *key = dbus_menu_layout_cache_key(bus_name, object_path, parent_id, depth);
+	GList *link          = dbus_menu_layout_cache_touch(key);
+	if (link == NULL)
+		return NULL;
+	DBusMenuCacheEntry *entry = (DBusMenuCacheEntry *)link->data;
+	*revision                 = entry->revision;
+	return g_variant_ref(entry->layout);
+}
+
+G_GNUC_INTERNAL void dbus_menu_layout_cache_store(const char *bus_name, const char *object_path,
+                                                  uint parent_id, int depth, uint revision,
+                                                  GVariant *layout)
+{
+	if (bus_name == NULL || object_path == NULL || layout == NULL)
+		return;
+	g_autofree char *key = dbus_menu_layout_cache_key(bus_name, object_path, parent_id, depth);
+	GList *link          = dbus_menu_layout_cache_touch(key);
+	DBusMenuCacheEntry *entry;
+	if (link != NULL)
+	{
+		entry = (DBusMenuCacheEntry *)link->data;
+		g_variant_unref(entry->layout);
+	}
+	else
+	{
+		entry      = g_new0(DBusMenuCacheEntry, 1);
+		entry->key = g_steal_pointer(&key);
+		g_queue_push_head(&cache_order, entry);
+		g_hash_table_insert(cache_index, entry->key, cache_order.head);
+	}
+	entry->layout   = g_variant_ref(layout);
+	entry->revision = revision;
+	if (cache_order.length > LAYOUT_CACHE_SIZE)
+	{
+		DBusMenuCacheEntry *last = (DBusMenuCacheEntry *)g_queue_pop_tail(&cache_order);
+		g_hash_table_remove(cache_index, last->key);
+		dbus_menu_cache_entry_free(last);
+	}
+}
@@ -0,0 +1,35 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL GVariant *dbus_menu_layout_cache_lookup(const char *bus_name,
+                                                        const char *object_path, uint parent_id,
+                                                        int depth, uint *revision);
+G_GNUC_INTERNAL void dbus_menu_layout_cache_store(const char *bus_name, const char *object_path,
+                                                  uint parent_id, int depth, uint revision,
+                                                  GVariant *layout);
+
+G_END_DECLS
+
+#endif // CACHE_H
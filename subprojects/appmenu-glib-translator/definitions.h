@@ -40,6 +40,7 @@ typedef enum
 #define SUBMENU_ACTION_MENUMODEL_QUARK_STR "submenu-action_menumodel"
 #define ACTIVATE_ID_QUARK_STR "checker-quark"
 #define POPULATED_QUARK "is-populated"
+#define NO_GROUP_CALLS_QUARK_STR "no-group-calls"
 
 #define DBUS_MENU_PROP_TYPE "type"
 #define DBUS_MENU_TYPE_SEPARATOR "separator"
@@ -0,0 +1,109 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "icon.h"
+
+/* Serialized icons are shared by all menus of the process, so items with the same icon share
+ * one GVariant. Themed icons are keyed by name, icon-data is keyed by its bytes. Nothing is
+ * decoded here: GMenuModel attributes can hold only serialized icons, so icon-data is passed
+ * to GTK as a bytes icon, and every widget showing it decodes the PNG itself. Both tables
+ * evict entries in least recently used order.
+ */
+#define ICON_TABLE_SIZE 256
+
+typedef struct
+{
+	GHashTable *index;
+	GQueue order;
+	GDestroyNotify key_free;
+} DBusMenuIconTable;
+
+typedef struct
+{
+	gpointer key;
+	GVariant *icon;
+} DBusMenuIconEntry;
+
+static DBusMenuIconTable icons_by_name = { NULL, G_QUEUE_INIT, g_free };
+static DBusMenuIconTable icons_by_data = { NULL, G_QUEUE_INIT, (GDestroyNotify)g_bytes_unref };
+
+static const guint8 png_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static GVariant *dbus_menu_icon_table_lookup(DBusMenuIconTable *table, gconstpointer key)
+{
+	GList *link = (GList *)g_hash_table_lookup(table->index, key);
+	if (link == NULL)
+		return NULL;
+	g_queue_unlink(&table->order, link);
+	g_queue_push_head_link(&table->order, link);
+	return g_variant_ref(((DBusMenuIconEntry *)link->data)->icon);
+}
+
+// Takes key and icon, returns a new reference to icon
+static GVariant *dbus_menu_icon_table_insert(DBusMenuIconTable *table, gpointer key,
+                                             GVariant *icon)
+{
+	DBusMenuIconEntry *entry = g_new0(DBusMenuIconEntry, 1);
+	entry->key               = key;
+	entry->icon              = icon;
+	g_queue_push_head(&table->order, entry);
+	g_hash_table_insert(table->index, entry->key, table->order.head);
+	if (table->order.length > ICON_TABLE_SIZE)
+	{
+		DBusMenuIconEntry *last = (DBusMenuIconEntry *)g_queue_pop_tail(&table->order);
+		g_hash_table_remove(table->index, last->key);
+		table->key_free(last->key);
+		g_variant_unref(last->icon);
+		g_free(last);
+	}
+	return g_variant_ref(icon);
+}
+
+G_GNUC_INTERNAL GVariant *dbus_menu_icon_from_name(const char *icon_name)
+{
+	if (icons_by_name.index == NULL)
+		icons_by_name.index = g_hash_table_new(g_str_hash, g_str_equal);
+	GVariant *ret = dbus_menu_icon_table_lookup(&icons_by_name, icon_name);
+	if (ret != NULL)
+		return ret;
+	g_autoptr(GIcon) icon = g_themed_icon_new(icon_name);
+	return dbus_menu_icon_table_insert(&icons_by_name,
+	                                   g_strdup(icon_name),
+	                                   g_variant_take_ref(g_icon_serialize(icon)));
+}
+
+// icon-data is PNG by specification, anything else is ignored
+G_GNUC_INTERNAL GVariant *dbus_menu_icon_from_data(GBytes *data)
+{
+	gsize size            = 0;
+	const guint8 *pointer = (const guint8 *)g_bytes_get_data(data, &size);
+	if (size < sizeof(png_signature) ||
+	    memcmp(pointer, png_signature, sizeof(png_signature)) != 0)
+		return NULL;
+	if (icons_by_data.index == NULL)
+		icons_by_data.index = g_hash_table_new(g_bytes_hash, g_bytes_equal);
+	GVariant *ret = dbus_menu_icon_table_lookup(&icons_by_data, data);
+	if (ret != NULL)
+		return ret;
+	g_autoptr(GIcon) icon = g_bytes_icon_new(data);
+	return dbus_menu_icon_table_insert(&icons_by_data,
+	                                   g_bytes_ref(data),
+	                                   g_variant_take_ref(g_icon_serialize(icon)));
+}
@@ -17,19 +17,24 @@
  */
 
 #include "importer.h"
+#include "actions.h"
 #include "dbusmenu-interface.h"
 #include "model.h"
+#include "pool.h"
 
 struct _DBusMenuImporter
 {
 	GObject parent_instance;
 	char *bus_name;
 	char *object_path;
+	int timeout;
+	bool prefetch;
+	bool no_reply;
+	int parse_interval;
 	ulong name_id;
-	GCancellable *cancellable;
 	DBusMenuXml *proxy;
 	DBusMenuModel *top_model;
-	GSimpleActionGroup *all_actions;
+	DBusMenuActionGroup *all_actions;
 };
 
 enum
@@ -39,17 +44,16 @@ enum
 	PROP_OBJECT_PATH,
 	PROP_MODEL,
 	PROP_ACTION_GROUP,
+	PROP_TIMEOUT,
+	PROP_PREFETCH,
+	PROP_NO_REPLY,
+	PROP_PARSE_INTERVAL,
 	LAST_PROP
 };
 
 static GParamSpec *properties[LAST_PROP] = { NULL };
 G_DEFINE_TYPE(DBusMenuImporter, dbus_menu_importer, G_TYPE_OBJECT)
 
-static bool dbus_menu_importer_check(DBusMenuImporter *menu)
-{
-	return DBUS_MENU_IS_XML(menu->proxy);
-}
-
 static void dbus_menu_importer_on_root_model_changed(GMenuModel *model, gint position, gint removed,
                                                      gint added, gpointer user_data)
 {
@@ -57,62 +61,25 @@ static void dbus_menu_importer_on_root_model_changed(GMenuModel *model, gint pos
 	g_object_notify_by_pspec(G_OBJECT(menu), properties[PROP_MODEL]);
 }
 
-static void proxy_ready_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+static void proxy_changed_cb(DBusMenuXml *proxy, gpointer user_data)
 {
-	g_autoptr(GError) error = NULL;
-	DBusMenuXml *proxy      = dbus_menu_xml_proxy_new_finish(res, &error);
-
-	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-		return;
-
 	DBusMenuImporter *menu = DBUS_MENU_IMPORTER(user_data);
-	menu->proxy            = proxy;
 
-	if (error)
-	{
-		g_warning("%s", error->message);
-		return;
-	}
-	if (dbus_menu_importer_check(menu))
-		g_object_set(menu->top_model, "xml", proxy, NULL);
+	g_set_object(&menu->proxy, proxy);
+	dbus_menu_action_group_set_xml(menu->all_actions, menu->proxy);
+	g_object_set(menu->top_model, "xml", menu->proxy, NULL);
 	g_object_notify_by_pspec(G_OBJECT(menu), properties[PROP_MODEL]);
 }
 
-static void name_appeared_cb(GDBusConnection *connection, const char *name, const char *name_owner,
-                             gpointer user_data)
-{
-	DBusMenuImporter *menu = DBUS_MENU_IMPORTER(user_data);
-
-	dbus_menu_xml_proxy_new(connection,
-	                        G_DBUS_PROXY_FLAGS_NONE,
-	                        menu->bus_name,
-	                        menu->object_path,
-	                        menu->cancellable,
-	                        proxy_ready_cb,
-	                        menu);
-}
-
-static void name_vanished_cb(GDBusConnection *connection, const char *name, gpointer user_data)
-{
-	DBusMenuImporter *menu = DBUS_MENU_IMPORTER(user_data);
-
-	g_object_set(menu->top_model, "xml", NULL, NULL);
-	g_object_notify_by_pspec(G_OBJECT(menu), properties[PROP_MODEL]);
-	g_clear_object(&menu->proxy);
-}
-
 static void dbus_menu_importer_constructed(GObject *object)
 {
 	G_OBJECT_CLASS(dbus_menu_importer_parent_class)->constructed(object);
 	DBusMenuImporter *menu = DBUS_MENU_IMPORTER(object);
 
-	menu->name_id = g_bus_watch_name(G_BUS_TYPE_SESSION,
-	                                 menu->bus_name,
-	                                 G_BUS_NAME_WATCHER_FLAGS_NONE,
-	                                 name_appeared_cb,
-	                                 name_vanished_cb,
-	                                 menu,
-	                                 NULL);
+	menu->name_id = dbus_menu_proxy_pool_acquire(menu->bus_name,
+	                                             menu->object_path,
+	                                             proxy_changed_cb,
+	                                             menu);
 }
 
 static void dbus_menu_importer_dispose(GObject *object)
@@ -121,11 +88,9 @@ static void dbus_menu_importer_dispose(GObject *object)
 
 	if (menu->name_id > 0)
 	{
-		g_bus_unwatch_name(menu->name_id);
+		dbus_menu_proxy_pool_release(menu->name_id);
 		menu->name_id = 0;
 	}
-	g_cancellable_cancel(menu->cancellable);
-	g_clear_object(&menu->cancellable);
 	g_signal_handlers_disconnect_by_data(menu->top_model, menu);
 	g_clear_object(&menu->top_model);
 	g_clear_object(&menu->proxy);
@@ -159,6 +124,27 @@ static void dbus_menu_importer_set_property(GObject *object, guint property_id,
 		menu->object_path = g_value_dup_string(value);
 		break;
 
+	case PROP_TIMEOUT:
+		menu->timeout = g_value_get_int(value);
+		dbus_menu_action_group_set_timeout(menu->all_actions, menu->timeout);
+		dbus_menu_model_set_timeout(menu->top_model, menu->timeout);
+		break;
+
+	case PROP_PREFETCH:
+		menu->prefetch = g_value_get_boolean(value);
+		dbus_menu_model_set_prefetch(menu->top_model, menu->prefetch);
+		break;
+
+	case PROP_NO_REPLY:
+		menu->no_reply = g_value_get_boolean(value);
+		dbus_menu_action_group_set_no_reply(menu->all_actions, menu->no_reply);
+		break;
+
+	case PROP_PARSE_INTERVAL:
+		menu->parse_interval = g_value_get_int(value);
+		dbus_menu_model_set_parse_interval(menu->top_model, menu->parse_interval);
+		break;
+
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
 		break;
@@ -177,6 +163,18 @@ static void dbus_menu_importer_get_property(GObject *object, guint property_id,
 	case PROP_ACTION_GROUP:
 		g_value_set_object(value, menu->all_actions);
 		break;
+	case PROP_TIMEOUT:
+		g_value_set_int(value, menu->timeout);
+		break;
+	case PROP_PREFETCH:
+		g_value_set_boolean(value, menu->prefetch);
+		break;
+	case PROP_NO_REPLY:
+		g_value_set_boolean(value, menu->no_reply);
+		break;
+	case PROP_PARSE_INTERVAL:
+		g_value_set_int(value, menu->parse_interval);
+		break;
 
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
@@ -210,6 +208,47 @@ static void install_properties(GObjectClass *object_class)
 	                        "action-group",
 	                        G_TYPE_ACTION_GROUP,
 	                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+	/* Deadline for every call to the menu owner, in milliseconds. A client that does not
+	 * answer in time makes the pending open or layout request fail instead of waiting for
+	 * the default D-Bus timeout. -1 means the D-Bus default.
+	 */
+	properties[PROP_TIMEOUT] =
+	    g_param_spec_int("timeout",
+	                     "timeout",
+	                     "timeout",
+	                     -1,
+	                     G_MAXINT,
+	                     -1,
+	                     G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+	/* Fetch the whole menu tree with one GetLayout call instead of one call per submenu.
+	 * Submenus which come without children are dynamic and are still fetched on open.
+	 */
+	properties[PROP_PREFETCH] =
+	    g_param_spec_boolean("prefetch",
+	                         "prefetch",
+	                         "prefetch",
+	                         false,
+	                         G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+	/* Send clicks as one-way messages that never start the menu owner. Failed clicks are
+	 * not reported then, even to the debug log.
+	 */
+	properties[PROP_NO_REPLY] =
+	    g_param_spec_boolean("no-reply",
+	                         "no-reply",
+	                         "no-reply",
+	                         false,
+	                         G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+	/* Minimal interval between two layout parses of one menu, in milliseconds. The first
+	 * layout is always parsed at once; only faster updates are collapsed into one parse.
+	 */
+	properties[PROP_PARSE_INTERVAL] =
+	    g_param_spec_int("parse-interval",
+	                     "parse-interval",
+	                     "parse-interval",
+	                     0,
+	                     G_MAXINT,
+	                     100,
+	                     G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
 	g_object_class_install_properties(object_class, LAST_PROP, properties);
 }
@@ -232,14 +271,13 @@ static void dbus_menu_importer_class_init(DBusMenuImporterClass *menu_class)
 static void dbus_menu_importer_init(DBusMenuImporter *menu)
 {
 	menu->proxy       = NULL;
-	menu->all_actions = g_simple_action_group_new();
+	menu->all_actions = dbus_menu_action_group_new();
 	menu->top_model =
 	    dbus_menu_model_new(0, NULL, menu->proxy, G_ACTION_GROUP(menu->all_actions));
 	g_signal_connect(menu->top_model,
 	                 "items-changed",
 	                 G_CALLBACK(dbus_menu_importer_on_root_model_changed),
 	                 menu);
-	menu->cancellable = g_cancellable_new();
 }
 
 DBusMenuImporter *dbus_menu_importer_new(const char *bus_name, const char *object_path)
@@ -17,9 +17,12 @@
  */
 
 #include <stdbool.h>
+#include <string.h>
 
+#include "actions.h"
 #include "dbusmenu-interface.h"
 #include "definitions.h"
+#include "icon.h"
 #include "item.h"
 #include "utils.h"
 
@@ -32,12 +35,258 @@
 G_GNUC_INTERNAL void dbus_menu_item_free(gpointer data);
 G_GNUC_INTERNAL DBusMenuItem *dbus_menu_item_copy(DBusMenuItem *src);
 G_DEFINE_BOXED_TYPE(DBusMenuItem, dbus_menu_item, dbus_menu_item_copy, dbus_menu_item_free)
-#if 0
-#include "item-pixbuf.c"
-#endif
 
 static void act_props_try_update(DBusMenuItem *item);
 
+typedef enum
+{
+	DBUS_MENU_ITEM_PROP_UNKNOWN,
+	DBUS_MENU_ITEM_PROP_ACCESSIBLE_DESC,
+	DBUS_MENU_ITEM_PROP_CHILDREN_DISPLAY,
+	DBUS_MENU_ITEM_PROP_DISPOSITION,
+	DBUS_MENU_ITEM_PROP_ENABLED,
+	DBUS_MENU_ITEM_PROP_ICON_DATA,
+	DBUS_MENU_ITEM_PROP_ICON_NAME,
+	DBUS_MENU_ITEM_PROP_LABEL,
+	DBUS_MENU_ITEM_PROP_SHORTCUT,
+	DBUS_MENU_ITEM_PROP_TOGGLE_STATE,
+	DBUS_MENU_ITEM_PROP_TOGGLE_TYPE,
+	DBUS_MENU_ITEM_PROP_TYPE,
+	DBUS_MENU_ITEM_PROP_VISIBLE,
+	DBUS_MENU_ITEM_PROP_X_KDE_TITLE,
+} DBusMenuItemProperty;
+
+/* Perfect hash over known property names: length and at most one character select the only
+ * candidate, so every name costs one string compare. Keep in sync with the enum above.
+ */
+static DBusMenuItemProperty dbus_menu_item_property_lookup(const char *name)
+{
+	DBusMenuItemProperty ret = DBUS_MENU_ITEM_PROP_UNKNOWN;
+	const char *expected     = NULL;
+	switch (strlen(name))
+	{
+	case 4:
+		ret      = DBUS_MENU_ITEM_PROP_TYPE;
+		expected = DBUS_MENU_PROP_TYPE;
+		break;
+	case 5:
+		ret      = DBUS_MENU_ITEM_PROP_LABEL;
+		expected = "label";
+		break;
+	case 7:
+		if (name[0] == 'e')
+		{
+			ret      = DBUS_MENU_ITEM_PROP_ENABLED;
+			expected = DBUS_MENU_PROPERTY_ENABLED;
+		}
+		else
+		{
+			ret      = DBUS_MENU_ITEM_PROP_VISIBLE;
+			expected = "visible";
+		}
+		break;
+	case 8:
+		ret      = DBUS_MENU_ITEM_PROP_SHORTCUT;
+		expected = "shortcut";
+		break;
+	case 9:
+		if (name[5] == 'd')
+		{
+			ret      = DBUS_MENU_ITEM_PROP_ICON_DATA;
+			expected = "icon-data";
+		}
+		else
+		{
+			ret      = DBUS_MENU_ITEM_PROP_ICON_NAME;
+			expected = "icon-name";
+		}
+		break;
+	case 11:
+		if (name[0] == 'd')
+		{
+			ret      = DBUS_MENU_ITEM_PROP_DISPOSITION;
+			expected = "disposition";
+		}
+		else if (name[0] == 't')
+		{
+			ret      = DBUS_MENU_ITEM_PROP_TOGGLE_TYPE;
+			expected = DBUS_MENU_PROP_TOGGLE_TYPE;
+		}
+		else
+		{
+			ret      = DBUS_MENU_ITEM_PROP_X_KDE_TITLE;
+			expected = "x-kde-title";
+		}
+		break;
+	case 12:
+		ret      = DBUS_MENU_ITEM_PROP_TOGGLE_STATE;
+		expected = DBUS_MENU_PROPERTY_TOGGLE_STATE;
+		break;
+	case 15:
+		ret      = DBUS_MENU_ITEM_PROP_ACCESSIBLE_DESC;
+		expected = "accessible-desc";
+		break;
+	case 16:
+		ret      = DBUS_MENU_ITEM_PROP_CHILDREN_DISPLAY;
+		expected = DBUS_MENU_PROP_CHILDREN_DISPLAY;
+		break;
+	default:
+		break;
+	}
+	if (expected == NULL || strcmp(name, expected))
+		return DBUS_MENU_ITEM_PROP_UNKNOWN;
+	return ret;
+}
+
+// Serial changes every time item content visible to GTK changes
+static uint last_serial = 0;
+
+G_GNUC_INTERNAL void dbus_menu_item_bump_serial(DBusMenuItem *item)
+{
+	item->serial = ++last_serial;
+}
+
+// Every attribute which can be set on item has a slot, so item does not need a table
+static const char *attribute_names[DBUS_MENU_N_ATTRIBUTES] = {
+	[DBUS_MENU_ATTRIBUTE_LABEL]          = G_MENU_ATTRIBUTE_LABEL,
+	[DBUS_MENU_ATTRIBUTE_ACTION]         = G_MENU_ATTRIBUTE_ACTION,
+	[DBUS_MENU_ATTRIBUTE_TARGET]         = G_MENU_ATTRIBUTE_TARGET,
+	[DBUS_MENU_ATTRIBUTE_SUBMENU_ACTION] = G_MENU_ATTRIBUTE_SUBMENU_ACTION,
+	[DBUS_MENU_ATTRIBUTE_HIDDEN_WHEN]    = G_MENU_ATTRIBUTE_HIDDEN_WHEN,
+	[DBUS_MENU_ATTRIBUTE_ACCEL]          = G_MENU_ATTRIBUTE_ACCEL,
+	[DBUS_MENU_ATTRIBUTE_ICON]           = G_MENU_ATTRIBUTE_ICON,
+	[DBUS_MENU_ATTRIBUTE_VERB_ICON]      = G_MENU_ATTRIBUTE_VERB_ICON,
+	[DBUS_MENU_ATTRIBUTE_HAS_ICON_NAME]  = HAS_ICON_NAME,
+};
+
+static int attribute_from_name(const char *name)
+{
+	for (int i = 0; i < DBUS_MENU_N_ATTRIBUTES; i++)
+		if (!g_strcmp0(attribute_names[i], name))
+			return i;
+	return -1;
+}
+
+// Takes floating reference, or adds one to non-floating value
+static void attr_set(DBusMenuItem *item, DBusMenuAttribute attr, GVariant *value)
+{
+	GVariant *old     = item->attrs[attr];
+	item->attrs[attr] = value != NULL ? g_variant_ref_sink(value) : NULL;
+	if (old != NULL)
+		g_variant_unref(old);
+}
+
+static bool attr_remove(DBusMenuItem *item, DBusMenuAttribute attr)
+{
+	bool found = item->attrs[attr] != NULL;
+	attr_set(item, attr, NULL);
+	return found;
+}
+
+static const char *attr_get_string(DBusMenuItem *item, DBusMenuAttribute attr)
+{
+	GVariant *value = item->attrs[attr];
+	if (value == NULL || !g_variant_is_of_type(value, G_VARIANT_TYPE_STRING))
+		return NULL;
+	return g_variant_get_string(value, NULL);
+}
+
+G_GNUC_INTERNAL GVariant *dbus_menu_item_get_attribute_value(DBusMenuItem *item,
+                                                             const char *attribute,
+                                                             const GVariantType *expected_type)
+{
+	int attr = attribute_from_name(attribute);
+	if (attr < 0 || item->attrs[attr] == NULL)
+		return NULL;
+	GVariant *value = item->attrs[attr];
+	if (expected_type != NULL && !g_variant_is_of_type(value, expected_type))
+		return NULL;
+	return g_variant_ref(value);
+}
+
+// Table is built only when GMenuModel user asks for all attributes at once
+G_GNUC_INTERNAL GHashTable *dbus_menu_item_get_attributes(DBusMenuItem *item)
+{
+	GHashTable *table =
+	    g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)g_variant_unref);
+	for (int i = 0; i < DBUS_MENU_N_ATTRIBUTES; i++)
+		if (item->attrs[i] != NULL)
+			g_hash_table_insert(table,
+			                    (gpointer)attribute_names[i],
+			                    g_variant_ref(item->attrs[i]));
+	return table;
+}
+
+G_GNUC_INTERNAL GMenuModel *dbus_menu_item_get_link(DBusMenuItem *item, const char *link)
+{
+	if (item->link == NULL || g_strcmp0(item->link_name, link))
+		return NULL;
+	return item->link;
+}
+
+// Takes ownership of model
+G_GNUC_INTERNAL void dbus_menu_item_set_link(DBusMenuItem *item, const char *link,
+                                             GMenuModel *model)
+{
+	GMenuModel *old = item->link;
+	item->link_name = link;
+	item->link      = model;
+	g_clear_object(&old);
+}
+
+G_GNUC_INTERNAL GHashTable *dbus_menu_item_get_links(DBusMenuItem *item)
+{
+	GHashTable *table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_object_unref);
+	if (item->link != NULL)
+		g_hash_table_insert(table, (gpointer)item->link_name, g_object_ref(item->link));
+	return table;
+}
+
+/* The only place which decides action type of an item. Type is chosen by the last property
+ * which defines it, any other property makes the item normal, unless type is already chosen.
+ * Returns true if this property sets the type.
+ */
+static bool dbus_menu_item_property_action_type(DBusMenuItemProperty property, GVariant *value,
+                                                bool action_creator_found,
+                                                DBusMenuActionType *action_type)
+{
+	const char *str = g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)
+	                      ? g_variant_get_string(value, NULL)
+	                      : NULL;
+	switch (property)
+	{
+	case DBUS_MENU_ITEM_PROP_CHILDREN_DISPLAY:
+		if (g_strcmp0(str, DBUS_MENU_CHILDREN_DISPLAY_SUBMENU))
+			return false;
+		*action_type = DBUS_MENU_ACTION_SUBMENU;
+		return true;
+	case DBUS_MENU_ITEM_PROP_TOGGLE_TYPE:
+		if (!g_strcmp0(str, DBUS_MENU_TOGGLE_TYPE_CHECK))
+			*action_type = DBUS_MENU_ACTION_CHECKMARK;
+		else if (!g_strcmp0(str, DBUS_MENU_TOGGLE_TYPE_RADIO))
+			*action_type = DBUS_MENU_ACTION_RADIO;
+		else
+			return false;
+		return true;
+	case DBUS_MENU_ITEM_PROP_TYPE:
+		if (!g_strcmp0(str, DBUS_MENU_TYPE_SEPARATOR))
+			*action_type = DBUS_MENU_ACTION_SECTION;
+		else if (!g_strcmp0(str, DBUS_MENU_TYPE_NORMAL))
+			*action_type = DBUS_MENU_ACTION_NORMAL;
+		else
+			return false;
+		return true;
+	case DBUS_MENU_ITEM_PROP_X_KDE_TITLE:
+		*action_type = DBUS_MENU_ACTION_SECTION;
+		return true;
+	default:
+		if (action_creator_found)
+			return false;
+		*action_type = DBUS_MENU_ACTION_NORMAL;
+		return true;
+	}
+}
+
 G_GNUC_INTERNAL DBusMenuItem *dbus_menu_item_new_first_section(u_int32_t id,
                                                                GActionGroup *action_group)
 {
@@ -46,11 +295,9 @@ G_GNUC_INTERNAL DBusMenuItem *dbus_menu_item_new_first_section(u_int32_t id,
 	item->action_type  = DBUS_MENU_ACTION_SECTION;
 	item->enabled      = false;
 	item->toggled      = false;
-	item->attrs =
-	    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
-	item->links = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_object_unref);
 	item->ref_action_group = action_group;
 	item_set_magic(item);
+	dbus_menu_item_bump_serial(item);
 	return item;
 }
 
@@ -63,106 +310,50 @@ G_GNUC_INTERNAL DBusMenuItem *dbus_menu_item_new(u_int32_t id, DBusMenuModel *pa
 	const char *prop;
 	GVariant *value;
 	item_set_magic(item);
+	dbus_menu_item_bump_serial(item);
 	item->enabled = true;
 	item->toggled = false;
 	item->id      = id;
-	item->attrs =
-	    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
-	item->links = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_object_unref);
 	g_object_get(parent_model, "action-group", &item->ref_action_group, "xml", &xml, NULL);
 	g_variant_iter_init(&iter, props);
 	// Iterate by immutable properties, it is construct_only
 	bool action_creator_found = false;
 	while (g_variant_iter_loop(&iter, "{&sv}", &prop, &value))
 	{
-		if (g_strcmp0(prop, DBUS_MENU_PROP_CHILDREN_DISPLAY) == 0)
-		{
-			if (value == NULL)
-			{
-				g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_SUBMENU_ACTION);
-				continue;
-			}
-			else if (g_strcmp0(g_variant_get_string(value, NULL),
-			                   DBUS_MENU_CHILDREN_DISPLAY_SUBMENU) == 0)
-			{
-				item->action_type = DBUS_MENU_ACTION_SUBMENU;
-				g_autofree char *name =
-				    dbus_menu_action_get_name(id, item->action_type, true);
-				g_hash_table_insert(item->attrs,
-				                    g_strdup(G_MENU_ATTRIBUTE_SUBMENU_ACTION),
-				                    g_variant_new_string(name));
-				action_creator_found = true;
-			}
-		}
-		else if (g_strcmp0(prop, DBUS_MENU_PROP_TOGGLE_TYPE) == 0)
-		{
-			g_autofree char *name =
-			    dbus_menu_action_get_name(id, item->action_type, true);
-			if (g_strcmp0(g_variant_get_string(value, NULL),
-			              DBUS_MENU_TOGGLE_TYPE_CHECK) == 0)
-			{
-				item->action_type = DBUS_MENU_ACTION_CHECKMARK;
-				g_hash_table_insert(item->attrs,
-				                    g_strdup(G_MENU_ATTRIBUTE_ACTION),
-				                    g_variant_new_string(name));
-				action_creator_found = true;
-			}
-			else if (g_strcmp0(g_variant_get_string(value, NULL),
-			                   DBUS_MENU_TOGGLE_TYPE_RADIO) == 0)
-			{
-				item->action_type = DBUS_MENU_ACTION_RADIO;
-				g_hash_table_insert(item->attrs,
-				                    g_strdup(G_MENU_ATTRIBUTE_ACTION),
-				                    g_variant_new_string(name));
-				GVariant *vstr =
-				    g_variant_new_string(DBUS_MENU_ACTION_RADIO_SELECTED);
-				g_hash_table_insert(item->attrs,
-				                    g_strdup(G_MENU_ATTRIBUTE_TARGET),
-				                    g_variant_ref_sink(vstr));
-				action_creator_found = true;
-			}
-		}
-		else if (g_strcmp0(prop, DBUS_MENU_PROP_TYPE) == 0)
-		{
-			const char *type = g_variant_get_string(value, NULL);
-			if (!g_strcmp0(type, DBUS_MENU_TYPE_SEPARATOR))
-			{
-				item->action_type    = DBUS_MENU_ACTION_SECTION;
-				action_creator_found = true;
-			}
-			else if (!g_strcmp0(type, DBUS_MENU_TYPE_NORMAL))
-			{
-				item->action_type = DBUS_MENU_ACTION_NORMAL;
-				g_autofree char *name =
-				    dbus_menu_action_get_name(id, item->action_type, true);
-				g_hash_table_insert(item->attrs,
-				                    g_strdup(G_MENU_ATTRIBUTE_ACTION),
-				                    g_variant_new_string(name));
-				action_creator_found = true;
-			}
-		}
-		else if (g_strcmp0(prop, "x-kde-title") == 0)
-		{
-			item->action_type = DBUS_MENU_ACTION_SECTION;
-			g_hash_table_insert(item->attrs, g_strdup(G_MENU_ATTRIBUTE_LABEL), value);
-			action_creator_found = true;
-		}
-		else if (!action_creator_found)
+		DBusMenuItemProperty property = dbus_menu_item_property_lookup(prop);
+		if (property == DBUS_MENU_ITEM_PROP_X_KDE_TITLE)
+			attr_set(item, DBUS_MENU_ATTRIBUTE_LABEL, value);
+		if (!dbus_menu_item_property_action_type(property,
+		                                         value,
+		                                         action_creator_found,
+		                                         &item->action_type))
+			continue;
+		action_creator_found  = true;
+		g_autofree char *name = dbus_menu_action_get_name(id, item->action_type, true);
+		switch (item->action_type)
 		{
-			item->action_type = DBUS_MENU_ACTION_NORMAL;
-			g_autofree char *name =
-			    dbus_menu_action_get_name(id, item->action_type, true);
-			g_hash_table_insert(item->attrs,
-			                    g_strdup(G_MENU_ATTRIBUTE_ACTION),
-			                    g_variant_new_string(name));
-			action_creator_found = true;
+		case DBUS_MENU_ACTION_SUBMENU:
+			attr_set(item,
+			         DBUS_MENU_ATTRIBUTE_SUBMENU_ACTION,
+			         g_variant_new_string(name));
+			break;
+		case DBUS_MENU_ACTION_RADIO:
+			attr_set(item, DBUS_MENU_ATTRIBUTE_ACTION, g_variant_new_string(name));
+			attr_set(item,
+			         DBUS_MENU_ATTRIBUTE_TARGET,
+			         g_variant_new_string(DBUS_MENU_ACTION_RADIO_SELECTED));
+			break;
+		case DBUS_MENU_ACTION_CHECKMARK:
+		case DBUS_MENU_ACTION_NORMAL:
+			attr_set(item, DBUS_MENU_ATTRIBUTE_ACTION, g_variant_new_string(name));
+			break;
+		default:
+			break;
 		}
 	}
 	if (item->action_type != DBUS_MENU_ACTION_SECTION)
-		g_hash_table_insert(item->attrs,
-		                    g_strdup(G_MENU_ATTRIBUTE_LABEL),
-		                    g_variant_new_string(""));
-	dbus_menu_item_update_props(item, props);
+		attr_set(item, DBUS_MENU_ATTRIBUTE_LABEL, g_variant_new_string(""));
+	dbus_menu_item_update_props(item, props, parent_model);
 	return item;
 }
 
@@ -172,10 +363,12 @@ G_GNUC_INTERNAL void dbus_menu_item_free(gpointer data)
 	if (item == NULL)
 		return;
 	item->magic = NULL;
-	g_clear_pointer(&item->attrs, g_hash_table_destroy);
-	g_clear_pointer(&item->links, g_hash_table_destroy);
-	g_clear_object(&item->ref_action);
-	g_source_remove_by_user_data(item);
+	for (int i = 0; i < DBUS_MENU_N_ATTRIBUTES; i++)
+		g_clear_pointer(&item->attrs[i], g_variant_unref);
+	g_clear_object(&item->link);
+	if (item->action_referenced)
+		dbus_menu_action_group_unreference(DBUS_MENU_ACTION_GROUP(item->ref_action_group),
+		                                   item->id);
 	g_slice_free(DBusMenuItem, data);
 }
 
@@ -186,80 +379,78 @@ G_GNUC_INTERNAL DBusMenuItem *dbus_menu_item_copy(DBusMenuItem *src)
 	dst->action_type      = src->action_type;
 	dst->enabled          = src->enabled;
 	dst->toggled          = src->toggled;
-	dst->ref_action       = G_ACTION(g_object_ref(src->ref_action));
 	dst->ref_action_group = src->ref_action_group;
-	dst->attrs            = g_hash_table_ref(src->attrs);
-	dst->links            = g_hash_table_ref(src->links);
+	if (src->action_referenced)
+		dbus_menu_action_group_reference(DBUS_MENU_ACTION_GROUP(dst->ref_action_group),
+		                                 dst->id,
+		                                 dst->action_type,
+		                                 NULL);
+	dst->action_referenced = src->action_referenced;
+	for (int i = 0; i < DBUS_MENU_N_ATTRIBUTES; i++)
+		if (src->attrs[i] != NULL)
+			dst->attrs[i] = g_variant_ref(src->attrs[i]);
+	dst->link_name = src->link_name;
+	if (src->link != NULL)
+		dst->link = g_object_ref(src->link);
 	return dst;
 }
 
-static bool attr_update_checked(DBusMenuItem *item, const char *key, GVariant *value)
+// Like attr_set(), value is consumed even if it is not changed
+static bool attr_update_checked(DBusMenuItem *item, DBusMenuAttribute attr, GVariant *value)
 {
-	GVariant *old  = (GVariant *)g_hash_table_lookup(item->attrs, key);
-	bool are_equal = false;
-	if (old != NULL)
-		are_equal = g_variant_equal(old, value);
-	if (!are_equal)
+	GVariant *old = item->attrs[attr];
+	if (old != NULL && g_variant_equal(old, value))
 	{
-		g_hash_table_insert(item->attrs, g_strdup(key), g_variant_ref_sink(value));
-		return true;
+		g_variant_unref(g_variant_ref_sink(value));
+		return false;
 	}
-	return false;
+	attr_set(item, attr, value);
+	return true;
 }
 
 G_GNUC_INTERNAL bool dbus_menu_item_is_firefox_stub(DBusMenuItem *item)
 {
-	const char *hidden_when =
-	    (const char *)g_hash_table_lookup(item->attrs, G_MENU_ATTRIBUTE_HIDDEN_WHEN);
-	const char *action =
-	    (const char *)g_hash_table_lookup(item->attrs, G_MENU_ATTRIBUTE_ACTION);
-	const char *label = (const char *)g_hash_table_lookup(item->attrs, G_MENU_ATTRIBUTE_LABEL);
+	const char *hidden_when = attr_get_string(item, DBUS_MENU_ATTRIBUTE_HIDDEN_WHEN);
+	const char *action      = attr_get_string(item, DBUS_MENU_ATTRIBUTE_ACTION);
+	const char *label       = attr_get_string(item, DBUS_MENU_ATTRIBUTE_LABEL);
 	if (!g_strcmp0(hidden_when, G_MENU_HIDDEN_WHEN_ACTION_MISSING) &&
 	    !g_strcmp0(action, DBUS_MENU_DISABLED_ACTION) && !g_strcmp0(label, "Label Empty"))
 		return true;
 	return false;
 }
 
-G_GNUC_INTERNAL void dbus_menu_item_preload(DBusMenuItem *item)
+G_GNUC_INTERNAL DBusMenuModel *dbus_menu_item_get_submenu(DBusMenuItem *item)
 {
 	if (!item_check_magic(item))
-		return;
+		return NULL;
 	if (item->action_type != DBUS_MENU_ACTION_SUBMENU)
-		return;
-	int id;
-	DBusMenuXml *xml = NULL;
-	bool need_update;
-	DBusMenuModel *submenu =
-	    DBUS_MENU_MODEL(g_hash_table_lookup(item->links, submenu_str(item->enabled)));
+		return NULL;
+	GMenuModel *submenu = dbus_menu_item_get_link(item, submenu_str(item->enabled));
 	if (!submenu || !DBUS_MENU_IS_MODEL(submenu))
-		return;
-	g_object_get(submenu, "parent-id", &id, "xml", &xml, NULL);
-	if (!xml || !DBUS_MENU_IS_XML(xml))
-		return;
-	dbus_menu_xml_call_event_sync(xml,
-	                              id,
-	                              "opened",
-	                              g_variant_new("v", g_variant_new_int32(0)),
-	                              CURRENT_TIME,
-	                              NULL,
-	                              NULL);
-	dbus_menu_xml_call_about_to_show_sync(xml, id, (gboolean *)&need_update, NULL, NULL);
-	need_update = need_update || dbus_menu_model_is_layout_update_required(submenu);
-	if (need_update)
-		dbus_menu_model_update_layout(submenu);
-}
-
-G_GNUC_INTERNAL bool dbus_menu_item_copy_attrs(DBusMenuItem *src, DBusMenuItem *dst)
-{
-	GHashTableIter iter;
-	g_hash_table_iter_init(&iter, src->attrs);
+		return NULL;
+	return DBUS_MENU_MODEL(submenu);
+}
+
+static bool dbus_menu_item_update_icon(DBusMenuItem *item, GVariant *icon)
+{
+	bool updated = attr_update_checked(item, DBUS_MENU_ATTRIBUTE_ICON, icon);
+	return attr_update_checked(item, DBUS_MENU_ATTRIBUTE_VERB_ICON, icon) || updated;
+}
+
+G_GNUC_INTERNAL bool dbus_menu_item_set_data_icon(DBusMenuItem *item, GVariant *icon)
+{
+	// icon-name has more priority
+	if (item->attrs[DBUS_MENU_ATTRIBUTE_HAS_ICON_NAME] != NULL)
+		return false;
+	return dbus_menu_item_update_icon(item, icon);
+}
+
+G_GNUC_INTERNAL bool dbus_menu_item_copy_attributes(DBusMenuItem *src, DBusMenuItem *dst)
+{
 	bool is_updated = false;
-	char *key;
-	GVariant *value;
-	while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&value))
-	{
-		is_updated = attr_update_checked(dst, key, value) || is_updated;
-	}
+	for (int i = 0; i < DBUS_MENU_N_ATTRIBUTES; i++)
+		if (src->attrs[i] != NULL)
+			is_updated = attr_update_checked(dst, i, src->attrs[i]) || is_updated;
 	return is_updated;
 }
 
@@ -268,26 +459,20 @@ G_GNUC_INTERNAL bool dbus_menu_item_update_enabled(DBusMenuItem *item, bool enab
 	bool updated = false;
 	if (item->action_type == DBUS_MENU_ACTION_SUBMENU && !item->toggled)
 	{
-		DBusMenuModel *submenu =
-		    DBUS_MENU_MODEL(g_hash_table_lookup(item->links, submenu_str(item->enabled)));
 		if (item->enabled != enabled)
 		{
-			if (submenu != NULL)
-			{
-				g_object_ref(submenu);
-				g_hash_table_remove(item->links, submenu_str(item->enabled));
-				g_hash_table_insert(item->links, submenu_str(enabled), submenu);
-			}
+			// Submenu link name tells GTK whether submenu can be opened
+			if (dbus_menu_item_get_link(item, submenu_str(item->enabled)) != NULL)
+				item->link_name = submenu_str(enabled);
 			if (enabled)
 			{
-				g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_ACTION);
+				attr_remove(item, DBUS_MENU_ATTRIBUTE_ACTION);
 			}
 			else
 			{
-				g_hash_table_insert(item->attrs,
-				                    g_strdup(G_MENU_ATTRIBUTE_ACTION),
-				                    g_variant_new_string(
-				                        DBUS_MENU_DISABLED_ACTION));
+				attr_set(item,
+				         DBUS_MENU_ATTRIBUTE_ACTION,
+				         g_variant_new_string(DBUS_MENU_DISABLED_ACTION));
 			}
 			updated = true;
 		}
@@ -299,24 +484,12 @@ G_GNUC_INTERNAL bool dbus_menu_item_update_enabled(DBusMenuItem *item, bool enab
 
 static void act_props_try_update(DBusMenuItem *item)
 {
-	if (!G_IS_ACTION(item->ref_action))
+	if (!item->action_referenced)
 		return;
-	g_simple_action_set_enabled(G_SIMPLE_ACTION(item->ref_action), item->enabled);
-	if (item->action_type == DBUS_MENU_ACTION_RADIO)
-	{
-		dbus_menu_action_lock(item->ref_action);
-		g_action_change_state((item->ref_action),
-		                      g_variant_new_string(
-		                          item->toggled ? DBUS_MENU_ACTION_RADIO_SELECTED
-		                                        : DBUS_MENU_ACTION_RADIO_UNSELECTED));
-		dbus_menu_action_unlock(item->ref_action);
-	}
-	else if (item->action_type == DBUS_MENU_ACTION_CHECKMARK)
-	{
-		dbus_menu_action_lock(item->ref_action);
-		g_action_change_state((item->ref_action), g_variant_new_boolean(item->toggled));
-		dbus_menu_action_unlock(item->ref_action);
-	}
+	dbus_menu_action_group_update(DBUS_MENU_ACTION_GROUP(item->ref_action_group),
+	                              item->id,
+	                              item->enabled,
+	                              item->toggled);
 }
 
 static bool dbus_menu_item_update_shortcut(DBusMenuItem *item, GVariant *value)
@@ -345,14 +518,11 @@ static bool dbus_menu_item_update_shortcut(DBusMenuItem *item, GVariant *value)
 	}
 	g_variant_unref(child);
 	g_autofree char *str = g_string_free(new_accel_string, false);
-	GVariant *new_accel  = g_variant_new_string(str);
-	bool updated         = attr_update_checked(item, G_MENU_ATTRIBUTE_ACCEL, new_accel);
-	if (!updated)
-		g_variant_unref(new_accel);
-	return updated;
+	return attr_update_checked(item, DBUS_MENU_ATTRIBUTE_ACCEL, g_variant_new_string(str));
 }
 
-G_GNUC_INTERNAL bool dbus_menu_item_update_props(DBusMenuItem *item, GVariant *props)
+G_GNUC_INTERNAL bool dbus_menu_item_update_props(DBusMenuItem *item, GVariant *props,
+                                                 DBusMenuModel *parent)
 {
 	GVariantIter iter;
 	const char *prop;
@@ -362,73 +532,83 @@ G_GNUC_INTERNAL bool dbus_menu_item_update_props(DBusMenuItem *item, GVariant *p
 	g_variant_iter_init(&iter, props);
 	while (g_variant_iter_loop(&iter, "{&sv}", &prop, &value))
 	{
-		if (g_strcmp0(prop, "accessible-desc") == 0)
+		switch (dbus_menu_item_property_lookup(prop))
+		{
+		case DBUS_MENU_ITEM_PROP_ACCESSIBLE_DESC:
 		{
 			// TODO: Can we supported this property?
 			// properties_is_updated = true;
+			break;
 		}
-		else if (g_strcmp0(prop, "enabled") == 0)
+		case DBUS_MENU_ITEM_PROP_ENABLED:
 		{
 			bool enabled = g_variant_get_boolean(value);
 			properties_is_updated =
 			    dbus_menu_item_update_enabled(item, enabled) || properties_is_updated;
+			break;
 		}
-#if 0
-		else if (g_strcmp0(prop, "icon-data") == 0)
+		case DBUS_MENU_ITEM_PROP_ICON_DATA:
 		{
+			gsize size = 0;
+			if (!g_variant_is_of_type(value, G_VARIANT_TYPE_BYTESTRING))
+				break;
+			const void *data = g_variant_get_fixed_array(value, &size, sizeof(guchar));
 			// icon-name has more priority
-            if (!g_hash_table_lookup(item->attrs, G_MENU_ATTRIBUTE_ICON))
-			{
-				g_autoptr(GIcon) icon = g_icon_new_pixbuf_from_variant(value);
-				GVariant *value       = g_icon_serialize(icon);
-				properties_is_updated =
-				    properties_is_updated ||
-                    attr_update_checked(item,
-				                                       G_MENU_ATTRIBUTE_ICON,
-				                                       value);
+			if (size == 0 || item->attrs[DBUS_MENU_ATTRIBUTE_HAS_ICON_NAME] != NULL)
+				break;
+			// Copy, so cache does not keep whole layout message alive
+			g_autoptr(GBytes) bytes  = g_bytes_new(data, size);
+			g_autoptr(GVariant) icon = dbus_menu_icon_from_data(bytes);
+			if (icon != NULL)
 				properties_is_updated =
-				    properties_is_updated ||
-                    attr_update_checked(item,
-				                                       G_MENU_ATTRIBUTE_VERB_ICON,
-				                                       value);
-			}
+				    dbus_menu_item_set_data_icon(item, icon) || properties_is_updated;
+			break;
 		}
-		else if (g_strcmp0(prop, "icon-name") == 0)
+		case DBUS_MENU_ITEM_PROP_ICON_NAME:
 		{
-			g_autoptr(GIcon) icon =
-			    g_themed_icon_new(g_variant_get_string(value, NULL));
-			GVariant *value             = g_icon_serialize(icon);
-			g_autoptr(GVariant) boolvar = g_variant_new_boolean(true);
-			properties_is_updated =
-			    properties_is_updated ||
-                attr_update_checked(item, G_MENU_ATTRIBUTE_ICON, value);
-			properties_is_updated =
-			    properties_is_updated ||
-                attr_update_checked(item,
-			                                       G_MENU_ATTRIBUTE_VERB_ICON,
-			                                       value);
+			if (!g_variant_is_of_type(value, G_VARIANT_TYPE_STRING))
+				break;
+			const char *icon_name = g_variant_get_string(value, NULL);
+			// Empty name means no icon
+			if (icon_name[0] == '\0')
+			{
+				if (attr_remove(item, DBUS_MENU_ATTRIBUTE_HAS_ICON_NAME))
+				{
+					attr_remove(item, DBUS_MENU_ATTRIBUTE_ICON);
+					attr_remove(item, DBUS_MENU_ATTRIBUTE_VERB_ICON);
+					properties_is_updated = true;
+				}
+				break;
+			}
+			g_autoptr(GVariant) icon = dbus_menu_icon_from_name(icon_name);
 			properties_is_updated =
-			    properties_is_updated ||
-                attr_update_checked(item, HAS_ICON_NAME, boolvar);
+			    dbus_menu_item_update_icon(item, icon) || properties_is_updated;
+			properties_is_updated = attr_update_checked(item,
+			                                            DBUS_MENU_ATTRIBUTE_HAS_ICON_NAME,
+			                                            g_variant_new_boolean(true)) ||
+			                        properties_is_updated;
+			break;
 		}
-#endif
-		else if (g_strcmp0(prop, "label") == 0)
+		case DBUS_MENU_ITEM_PROP_LABEL:
 		{
 			properties_is_updated =
-			    attr_update_checked(item, G_MENU_ATTRIBUTE_LABEL, value) ||
+			    attr_update_checked(item, DBUS_MENU_ATTRIBUTE_LABEL, value) ||
 			    properties_is_updated;
+			break;
 		}
-		else if (g_strcmp0(prop, "shortcut") == 0)
+		case DBUS_MENU_ITEM_PROP_SHORTCUT:
 		{
 			properties_is_updated =
 			    dbus_menu_item_update_shortcut(item, value) || properties_is_updated;
+			break;
 		}
-		else if (g_strcmp0(prop, "toggle-state") == 0)
+		case DBUS_MENU_ITEM_PROP_TOGGLE_STATE:
 		{
 			item->toggled = g_variant_get_int32(value) > 0;
 			act_props_try_update(item);
+			break;
 		}
-		else if (g_strcmp0(prop, "visible") == 0)
+		case DBUS_MENU_ITEM_PROP_VISIBLE:
 		{
 			bool vis = g_variant_get_boolean(value);
 			if (item->action_type == DBUS_MENU_ACTION_SECTION)
@@ -439,37 +619,36 @@ G_GNUC_INTERNAL bool dbus_menu_item_update_props(DBusMenuItem *item, GVariant *p
 			{
 				g_autofree char *name =
 				    dbus_menu_action_get_name(item->id, item->action_type, true);
-				bool found =
-				    g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_HIDDEN_WHEN);
+				bool found = attr_remove(item, DBUS_MENU_ATTRIBUTE_HIDDEN_WHEN);
 				if (found)
 				{
-					g_hash_table_insert(item->attrs,
-					                    g_strdup(G_MENU_ATTRIBUTE_ACTION),
-					                    g_variant_new_string(name));
+					attr_set(item,
+					         DBUS_MENU_ATTRIBUTE_ACTION,
+					         g_variant_new_string(name));
 					properties_is_updated = true;
 				}
 			}
 			else
 			{
-				bool found = g_hash_table_contains(item->attrs,
-				                                   G_MENU_ATTRIBUTE_HIDDEN_WHEN);
+				bool found = item->attrs[DBUS_MENU_ATTRIBUTE_HIDDEN_WHEN] != NULL;
 				if (!found)
 				{
-					g_hash_table_insert(item->attrs,
-					                    g_strdup(G_MENU_ATTRIBUTE_HIDDEN_WHEN),
-					                    g_variant_new_string(
-					                        G_MENU_HIDDEN_WHEN_ACTION_MISSING));
-					g_hash_table_insert(item->attrs,
-					                    g_strdup(G_MENU_ATTRIBUTE_ACTION),
-					                    g_variant_new_string(
-					                        DBUS_MENU_DISABLED_ACTION));
+					attr_set(item,
+					         DBUS_MENU_ATTRIBUTE_HIDDEN_WHEN,
+					         g_variant_new_string(G_MENU_HIDDEN_WHEN_ACTION_MISSING));
+					attr_set(item,
+					         DBUS_MENU_ATTRIBUTE_ACTION,
+					         g_variant_new_string(DBUS_MENU_DISABLED_ACTION));
 					properties_is_updated = true;
 				}
 			}
+			break;
 		}
-		else
+		default:
 		{
 			g_debug("updating unsupported property - '%s'", prop);
+			break;
+		}
 		}
 	}
 	return properties_is_updated;
@@ -484,58 +663,67 @@ G_GNUC_INTERNAL bool dbus_menu_item_remove_props(DBusMenuItem *item, GVariant *p
 	g_variant_iter_init(&iter, props);
 	while (g_variant_iter_next(&iter, "&s", &prop))
 	{
-		if (g_strcmp0(prop, "accessible-desc") == 0)
+		switch (dbus_menu_item_property_lookup(prop))
+		{
+		case DBUS_MENU_ITEM_PROP_ACCESSIBLE_DESC:
 		{
 			// TODO: Can we support this property?
 			// properties_is_updated = true;
+			break;
 		}
-		else if (g_strcmp0(prop, "enabled") == 0)
+		case DBUS_MENU_ITEM_PROP_ENABLED:
 		{
 			bool enabled = true;
 			dbus_menu_item_update_enabled(item, enabled);
+			break;
 		}
-		else if (g_strcmp0(prop, "icon-name") == 0)
+		case DBUS_MENU_ITEM_PROP_ICON_NAME:
 		{
-			if (g_hash_table_lookup(item->attrs, HAS_ICON_NAME))
+			if (item->attrs[DBUS_MENU_ATTRIBUTE_HAS_ICON_NAME] != NULL)
 			{
-				g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_ICON);
-				g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_VERB_ICON);
-				g_hash_table_remove(item->attrs, HAS_ICON_NAME);
+				attr_remove(item, DBUS_MENU_ATTRIBUTE_ICON);
+				attr_remove(item, DBUS_MENU_ATTRIBUTE_VERB_ICON);
+				attr_remove(item, DBUS_MENU_ATTRIBUTE_HAS_ICON_NAME);
 				properties_is_updated = true;
 			}
+			break;
 		}
-		else if (g_strcmp0(prop, "icon-data") == 0)
+		case DBUS_MENU_ITEM_PROP_ICON_DATA:
 		{
-			if (!g_hash_table_lookup(item->attrs, HAS_ICON_NAME))
+			if (item->attrs[DBUS_MENU_ATTRIBUTE_HAS_ICON_NAME] == NULL)
 			{
-				g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_ICON);
-				g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_VERB_ICON);
+				attr_remove(item, DBUS_MENU_ATTRIBUTE_ICON);
+				attr_remove(item, DBUS_MENU_ATTRIBUTE_VERB_ICON);
 				properties_is_updated = true;
 			}
+			break;
 		}
-		else if (g_strcmp0(prop, "label") == 0)
+		case DBUS_MENU_ITEM_PROP_LABEL:
 		{
-			g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_LABEL);
+			attr_remove(item, DBUS_MENU_ATTRIBUTE_LABEL);
 			properties_is_updated = true;
+			break;
 		}
-		else if (g_strcmp0(prop, "shortcut") == 0)
+		case DBUS_MENU_ITEM_PROP_SHORTCUT:
 		{
-			g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_ACCEL);
+			attr_remove(item, DBUS_MENU_ATTRIBUTE_ACCEL);
 			properties_is_updated = true;
+			break;
 		}
-		else if (g_strcmp0(prop, "visible") == 0)
+		case DBUS_MENU_ITEM_PROP_VISIBLE:
 		{
 			g_autofree char *name =
 			    dbus_menu_action_get_name(item->id, item->action_type, false);
-			g_hash_table_remove(item->attrs, G_MENU_ATTRIBUTE_HIDDEN_WHEN);
-			g_hash_table_insert(item->attrs,
-			                    g_strdup(G_MENU_ATTRIBUTE_ACTION),
-			                    g_variant_new_string(name));
+			attr_remove(item, DBUS_MENU_ATTRIBUTE_HIDDEN_WHEN);
+			attr_set(item, DBUS_MENU_ATTRIBUTE_ACTION, g_variant_new_string(name));
 			properties_is_updated = true;
+			break;
 		}
-		else
+		default:
 		{
 			g_debug("removing unsupported property - '%s'", prop);
+			break;
+		}
 		}
 	}
 	return properties_is_updated;
@@ -553,6 +741,36 @@ G_GNUC_INTERNAL int dbus_menu_item_id_compare_func(const DBusMenuItem *a, gconst
 	return GPOINTER_TO_UINT(b) - a->id;
 }
 
+// Action type of an item with these properties, as dbus_menu_item_new() chooses it
+static DBusMenuActionType dbus_menu_item_props_action_type(GVariant *props)
+{
+	DBusMenuActionType action_type = DBUS_MENU_ACTION_SECTION;
+	bool action_creator_found      = false;
+	GVariantIter iter;
+	const char *prop;
+	GVariant *value;
+	g_variant_iter_init(&iter, props);
+	while (g_variant_iter_loop(&iter, "{&sv}", &prop, &value))
+		action_creator_found =
+		    dbus_menu_item_property_action_type(dbus_menu_item_property_lookup(prop),
+		                                        value,
+		                                        action_creator_found,
+		                                        &action_type) ||
+		    action_creator_found;
+	return action_type;
+}
+
+/* Item with the same id and kind is updated in place by the layout parser. Sections are
+ * never reused this way, they are matched by the parser itself.
+ */
+G_GNUC_INTERNAL bool dbus_menu_item_is_reusable(DBusMenuItem *item, u_int32_t id,
+                                                GVariant *props)
+{
+	if (item->id != id || item->action_type == DBUS_MENU_ACTION_SECTION)
+		return false;
+	return item->action_type == dbus_menu_item_props_action_type(props);
+}
+
 G_GNUC_INTERNAL bool dbus_menu_item_compare_immutable(DBusMenuItem *a, DBusMenuItem *b)
 {
 	if (a->id != b->id)
@@ -586,7 +804,7 @@ G_GNUC_INTERNAL bool dbus_menu_item_copy_submenu(DBusMenuItem *src, DBusMenuItem
 			if (dst->toggled)
 				dst->enabled = true;
 			submenu = dbus_menu_model_new(dst->id, parent, xml, dst->ref_action_group);
-			g_hash_table_insert(dst->links, submenu_str(dst->enabled), submenu);
+			dbus_menu_item_set_link(dst, submenu_str(dst->enabled), G_MENU_MODEL(submenu));
 			return true;
 		}
 		return false;
@@ -596,9 +814,10 @@ G_GNUC_INTERNAL bool dbus_menu_item_copy_submenu(DBusMenuItem *src, DBusMenuItem
 	{
 		if (src->toggled || dst->toggled)
 			dst->enabled = dst->toggled = true;
-		submenu =
-		    DBUS_MENU_MODEL(g_hash_table_lookup(src->links, submenu_str(src->enabled)));
-		g_hash_table_insert(dst->links, submenu_str(dst->enabled), g_object_ref(submenu));
+		submenu = DBUS_MENU_MODEL(dbus_menu_item_get_link(src, submenu_str(src->enabled)));
+		dbus_menu_item_set_link(dst,
+		                        submenu_str(dst->enabled),
+		                        G_MENU_MODEL(g_object_ref(submenu)));
 		g_object_set(submenu, "parent-id", dst->id, NULL);
 		return true;
 	}
@@ -609,15 +828,15 @@ G_GNUC_INTERNAL void dbus_menu_item_generate_action(DBusMenuItem *item, DBusMenu
 {
 	if (item->action_type == DBUS_MENU_ACTION_SECTION)
 		return;
-	if(!item->ref_action_group)
+	if (!DBUS_MENU_IS_ACTION_GROUP(item->ref_action_group))
 		return;
-	DBusMenuXml *xml;
-	DBusMenuModel *submenu = g_hash_table_lookup(item->links, submenu_str(item->enabled));
-	g_object_get(parent, "xml", &xml, NULL);
-	item->ref_action = dbus_menu_action_reference(item->id,
-	                                              xml,
-	                                              submenu,
-	                                              G_ACTION_MAP(item->ref_action_group),
-	                                              item->action_type);
+	DBusMenuActionGroup *group = DBUS_MENU_ACTION_GROUP(item->ref_action_group);
+	DBusMenuModel *submenu =
+	    (DBusMenuModel *)dbus_menu_item_get_link(item, submenu_str(item->enabled));
+	// Reference the new record first, so an unchanged action is not removed and re-added
+	dbus_menu_action_group_reference(group, item->id, item->action_type, submenu);
+	if (item->action_referenced)
+		dbus_menu_action_group_unreference(group, item->id);
+	item->action_referenced = true;
 	act_props_try_update(item);
 }
@@ -27,21 +27,38 @@
 
 G_BEGIN_DECLS
 
-typedef struct
+typedef enum
+{
+	DBUS_MENU_ATTRIBUTE_LABEL,
+	DBUS_MENU_ATTRIBUTE_ACTION,
+	DBUS_MENU_ATTRIBUTE_TARGET,
+	DBUS_MENU_ATTRIBUTE_SUBMENU_ACTION,
+	DBUS_MENU_ATTRIBUTE_HIDDEN_WHEN,
+	DBUS_MENU_ATTRIBUTE_ACCEL,
+	DBUS_MENU_ATTRIBUTE_ICON,
+	DBUS_MENU_ATTRIBUTE_VERB_ICON,
+	DBUS_MENU_ATTRIBUTE_HAS_ICON_NAME,
+	DBUS_MENU_N_ATTRIBUTES
+} DBusMenuAttribute;
+
+struct _DBusMenuItem
 {
 	int section_num;
 	int place;
 	u_int32_t id;
+	uint serial;
 	GActionGroup *ref_action_group;
 	// FIXME: Cannot have activatable submenu item.
-	GAction *ref_action;
-	GHashTable *attrs;
-	GHashTable *links;
+	bool action_referenced;
+	GVariant *attrs[DBUS_MENU_N_ATTRIBUTES];
+	// Item has at most one link: a section or a (maybe disabled) submenu
+	const char *link_name;
+	GMenuModel *link;
 	DBusMenuActionType action_type;
 	bool enabled;
 	bool toggled;
 	gpointer magic;
-} DBusMenuItem;
+};
 
 G_GNUC_INTERNAL DBusMenuItem *dbus_menu_item_new(u_int32_t id, DBusMenuModel *parent_model,
                                                  GVariant *props);
@@ -50,16 +67,36 @@ G_GNUC_INTERNAL DBusMenuItem *dbus_menu_item_new_first_section(u_int32_t id,
 
 G_GNUC_INTERNAL void dbus_menu_item_free(gpointer data);
 
+G_GNUC_INTERNAL void dbus_menu_item_bump_serial(DBusMenuItem *item);
+
 G_GNUC_INTERNAL bool dbus_menu_item_update_enabled(DBusMenuItem *item, bool enabled);
 
-G_GNUC_INTERNAL bool dbus_menu_item_update_props(DBusMenuItem *item, GVariant *props);
+G_GNUC_INTERNAL bool dbus_menu_item_update_props(DBusMenuItem *item, GVariant *props,
+                                                 DBusMenuModel *parent);
+
+G_GNUC_INTERNAL bool dbus_menu_item_set_data_icon(DBusMenuItem *item, GVariant *icon);
 
 G_GNUC_INTERNAL bool dbus_menu_item_remove_props(DBusMenuItem *item, GVariant *props);
 
 G_GNUC_INTERNAL bool dbus_menu_item_compare_immutable(DBusMenuItem *a, DBusMenuItem *b);
+G_GNUC_INTERNAL bool dbus_menu_item_is_reusable(DBusMenuItem *item, u_int32_t id,
+                                                GVariant *props);
 
 G_GNUC_INTERNAL bool dbus_menu_item_copy_attributes(DBusMenuItem *src, DBusMenuItem *dst);
 
+G_GNUC_INTERNAL GVariant *dbus_menu_item_get_attribute_value(DBusMenuItem *item,
+                                                             const char *attribute,
+                                                             const GVariantType *expected_type);
+
+G_GNUC_INTERNAL GHashTable *dbus_menu_item_get_attributes(DBusMenuItem *item);
+
+G_GNUC_INTERNAL GMenuModel *dbus_menu_item_get_link(DBusMenuItem *item, const char *link);
+
+G_GNUC_INTERNAL void dbus_menu_item_set_link(DBusMenuItem *item, const char *link,
+                                             GMenuModel *model);
+
+G_GNUC_INTERNAL GHashTable *dbus_menu_item_get_links(DBusMenuItem *item);
+
 G_GNUC_INTERNAL bool dbus_menu_item_is_firefox_stub(DBusMenuItem *item);
 
 G_GNUC_INTERNAL bool dbus_menu_item_copy_submenu(DBusMenuItem *src, DBusMenuItem *dst,
@@ -67,7 +104,7 @@ G_GNUC_INTERNAL bool dbus_menu_item_copy_submenu(DBusMenuItem *src, DBusMenuItem
 
 G_GNUC_INTERNAL void dbus_menu_item_generate_action(DBusMenuItem *item, DBusMenuModel *parent);
 
-G_GNUC_INTERNAL void dbus_menu_item_preload(DBusMenuItem *item);
+G_GNUC_INTERNAL DBusMenuModel *dbus_menu_item_get_submenu(DBusMenuItem *item);
 
 G_GNUC_INTERNAL int dbus_menu_item_id_compare_func(const DBusMenuItem *a, gconstpointer b,
                                                    gpointer user_data);
@@ -17,7 +17,9 @@
  */
 
 #include <inttypes.h>
+#include <string.h>
 
+#include "cache.h"
 #include "debug.h"
 #include "definitions.h"
 #include "item.h"
@@ -30,13 +32,30 @@ struct _DBusMenuModel
 
 	uint parent_id;
 	uint current_revision;
+	uint layout_revision;
+	bool layout_cached;
 	GCancellable *cancellable;
 	DBusMenuXml *xml;
 	GActionGroup *received_action_group;
 	GSequence *items;
+	GHashTable *ids;
+	GPtrArray *sections;
+	GArray *section_sizes;
 	GVariant *current_layout;
 	bool layout_update_required;
+	int layout_depth;
 	uint parse_pending;
+	uint parse_interval;
+	int timeout;
+	uint parse_count;
+	gint64 last_parse;
+	GHashTable *preload_ids;
+	uint preload_source;
+	GHashTable *pending_changes;
+	uint pending_count;
+	uint pending_source;
+	GHashTable *refresh_ids;
+	uint refresh_source;
 };
 
 static const char *property_names[] = { "accessible-desc",
@@ -61,8 +80,27 @@ enum
 	NUM_PROPS
 };
 
+/* Proxy is shared by all importers of the same menu, so the timeout of this importer is
+ * passed with each call which waits for a reply. Results are still read by generated
+ * _finish() functions.
+ */
+static void dbus_menu_model_call(DBusMenuModel *menu, const char *method, GVariant *parameters,
+                                 GAsyncReadyCallback callback, gpointer user_data)
+{
+	g_dbus_proxy_call(G_DBUS_PROXY(menu->xml),
+	                  method,
+	                  parameters,
+	                  G_DBUS_CALL_FLAGS_NONE,
+	                  menu->timeout,
+	                  menu->cancellable,
+	                  callback,
+	                  user_data);
+}
+
 static GParamSpec *properties[NUM_PROPS] = { NULL };
 
+static void dbus_menu_model_reindex(DBusMenuModel *menu);
+static void layout_parse(DBusMenuModel *menu, GVariant *layout);
 static DBusMenuItem *dbus_menu_model_find(DBusMenuModel *menu, uint item_id);
 static DBusMenuItem *dbus_menu_model_find_section(DBusMenuModel *menu, uint section_num);
 static GSequenceIter *dbus_menu_model_find_place(DBusMenuModel *menu, uint section_num, int place);
@@ -81,65 +119,42 @@ static void dbus_menu_model_get_item_attributes(GMenuModel *model, gint position
                                                 GHashTable **table)
 {
 	DBusMenuModel *menu = DBUS_MENU_MODEL(model);
-	for (GSequenceIter *iter = g_sequence_get_begin_iter(menu->items);
-	     !g_sequence_iter_is_end(iter);
-	     iter = g_sequence_iter_next(iter))
-	{
-		DBusMenuItem *item = (DBusMenuItem *)g_sequence_get(iter);
-		if (item->section_num == position && item->place == -1)
-		{
-			*table = g_hash_table_ref(item->attrs);
-			return;
-		}
-	}
+	DBusMenuItem *item  = dbus_menu_model_find_section(menu, position);
+	if (item != NULL)
+		*table = dbus_menu_item_get_attributes(item);
 }
 
-static void dbus_menu_model_get_item_links(GMenuModel *model, gint position, GHashTable **table)
+static GVariant *dbus_menu_model_get_item_attribute_value(GMenuModel *model, gint position,
+                                                          const gchar *attribute,
+                                                          const GVariantType *expected_type)
 {
 	DBusMenuModel *menu = DBUS_MENU_MODEL(model);
-	for (GSequenceIter *iter = g_sequence_get_begin_iter(menu->items);
-	     !g_sequence_iter_is_end(iter);
-	     iter = g_sequence_iter_next(iter))
-	{
-		DBusMenuItem *item = (DBusMenuItem *)g_sequence_get(iter);
-		if (item->section_num == position && item->place == -1)
-		{
-			*table = g_hash_table_ref(item->links);
-			return;
-		}
-	}
+	DBusMenuItem *item  = dbus_menu_model_find_section(menu, position);
+	if (item == NULL)
+		return NULL;
+	return dbus_menu_item_get_attribute_value(item, attribute, expected_type);
 }
 
-static int dbus_menu_model_is_mutable(GMenuModel *model)
+static void dbus_menu_model_get_item_links(GMenuModel *model, gint position, GHashTable **table)
 {
-	return true;
+	DBusMenuModel *menu = DBUS_MENU_MODEL(model);
+	DBusMenuItem *item  = dbus_menu_model_find_section(menu, position);
+	if (item != NULL)
+		*table = dbus_menu_item_get_links(item);
 }
 
-struct layout_data
-{
-	GMenuModel *model;
-	int section_num;
-	uint pos;
-	uint old_num;
-	uint new_num;
-};
-
-GSequence *dbus_menu_model_items(DBusMenuModel *model)
+static GMenuModel *dbus_menu_model_get_item_link(GMenuModel *model, gint position,
+                                                 const gchar *link)
 {
-	return model->items;
+	DBusMenuModel *menu = DBUS_MENU_MODEL(model);
+	DBusMenuItem *item  = dbus_menu_model_find_section(menu, position);
+	GMenuModel *ret     = item != NULL ? dbus_menu_item_get_link(item, link) : NULL;
+	return ret != NULL ? g_object_ref(ret) : NULL;
 }
 
-int queue_compare_func(const struct layout_data *a, const struct layout_data *b)
+static int dbus_menu_model_is_mutable(GMenuModel *model)
 {
-	if (a->model != b->model)
-		return DBUS_MENU_IS_MODEL(a->model) ? -1 : 1;
-	else if (a->old_num != b->old_num)
-		return b->old_num - a->old_num;
-	else if (a->new_num != b->new_num)
-		return b->new_num - a->new_num;
-	else if (a->pos != b->pos)
-		return b->pos - a->pos;
-	return 0;
+	return true;
 }
 
 static int dbus_menu_model_sort_func(gconstpointer a, gconstpointer b,
@@ -154,47 +169,253 @@ static int dbus_menu_model_sort_func(gconstpointer a, gconstpointer b,
 	return aitem->place - bitem->place;
 }
 
-static void add_signal_to_queue(DBusMenuModel *model, GQueue *queue, int sect_num, int pos,
-                                int removed, int added)
+// In-place change of items [start, end) of a section
+struct pending_range
 {
-	struct layout_data *data = g_new0(struct layout_data, 1);
-	if (sect_num >= 0)
+	uint start;
+	uint end;
+};
+
+// Ranges are kept sorted and disjoint, touching ranges are merged too
+static void pending_ranges_add(GArray *ranges, uint start, uint end)
+{
+	uint i = 0;
+	while (i < ranges->len && g_array_index(ranges, struct pending_range, i).end < start)
+		i++;
+	uint j = i;
+	for (; j < ranges->len && g_array_index(ranges, struct pending_range, j).start <= end; j++)
 	{
-		DBusMenuItem *item = dbus_menu_model_find_section(model, sect_num);
-		data->model = G_MENU_MODEL(g_hash_table_lookup(item->links, G_MENU_LINK_SECTION));
+		struct pending_range *range = &g_array_index(ranges, struct pending_range, j);
+		start                       = MIN(start, range->start);
+		end                         = MAX(end, range->end);
 	}
-	else
+	g_array_remove_range(ranges, i, j - i);
+	struct pending_range merged = { start, end };
+	g_array_insert_val(ranges, i, merged);
+}
+
+static bool pending_changes_flush(DBusMenuModel *menu)
+{
+	menu->pending_source = 0;
+	// Handlers may query the model, so emit from a detached set
+	g_autoptr(GHashTable) pending = menu->pending_changes;
+	menu->pending_changes =
+	    g_hash_table_new_full(g_direct_hash,
+	                          g_direct_equal,
+	                          g_object_unref,
+	                          (GDestroyNotify)g_array_unref);
+	uint queued         = menu->pending_count;
+	uint emitted        = 0;
+	menu->pending_count = 0;
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, pending);
+	while (g_hash_table_iter_next(&iter, &key, &value))
 	{
-		data->model = G_MENU_MODEL(model);
+		GArray *ranges = (GArray *)value;
+		for (uint i = 0; i < ranges->len; i++, emitted++)
+		{
+			struct pending_range *range = &g_array_index(ranges, struct pending_range, i);
+			uint len                    = range->end - range->start;
+			g_menu_model_items_changed(G_MENU_MODEL(key), range->start, len, len);
+		}
 	}
-	data->section_num = sect_num;
-	data->pos         = pos;
-	data->old_num     = removed;
-	data->new_num     = added;
-	gpointer l        = g_queue_find_custom(queue, data, (GCompareFunc)queue_compare_func);
-	if (!l)
-		g_queue_push_head(queue, data);
+	if (queued > emitted)
+		g_debug("Coalesced %u item updates of %u into %u signals",
+		        queued - emitted,
+		        queued,
+		        emitted);
+	return G_SOURCE_REMOVE;
 }
 
-static bool queue_emit_now(struct layout_data *index)
+// Pending changes refer to current positions, so they must be sent before layout is changed
+static void pending_changes_flush_now(DBusMenuModel *menu)
 {
-	if (!G_IS_MENU_MODEL(index->model))
-		return G_SOURCE_REMOVE;
+	if (!menu->pending_source)
+		return;
+	g_source_remove(menu->pending_source);
+	pending_changes_flush(menu);
+}
 
-	g_menu_model_items_changed(index->model, index->pos, index->old_num, index->new_num);
-	return G_SOURCE_REMOVE;
+/* Changes are flushed once per main loop iteration, before GDK relayout and redraw
+ * (GDK_PRIORITY_REDRAW is G_PRIORITY_HIGH_IDLE + 20), so one frame gets one signal per range.
+ */
+static void dbus_menu_model_queue_change(DBusMenuModel *menu, uint section_num, uint pos)
+{
+	DBusMenuItem *item = dbus_menu_model_find_section(menu, section_num);
+	if (item == NULL)
+		return;
+	GMenuModel *section = dbus_menu_item_get_link(item, G_MENU_LINK_SECTION);
+	GArray *ranges      = (GArray *)g_hash_table_lookup(menu->pending_changes, section);
+	if (ranges == NULL)
+	{
+		ranges = g_array_new(false, false, sizeof(struct pending_range));
+		g_hash_table_insert(menu->pending_changes, g_object_ref(section), ranges);
+	}
+	pending_ranges_add(ranges, pos, pos + 1);
+	menu->pending_count++;
+	if (!menu->pending_source)
+		menu->pending_source = g_idle_add_full(G_PRIORITY_HIGH_IDLE + 10,
+		                                       (GSourceFunc)pending_changes_flush,
+		                                       menu,
+		                                       NULL);
+}
+
+struct preload_data
+{
+	DBusMenuModel *menu;
+	GArray *ids;
+	gint64 start;
+};
+
+static struct
+{
+	uint batches;
+	uint submenus;
+	uint calls;
+	gint64 latency;
+} preload_stats;
+
+static void preload_stats_add(uint submenus, uint calls, gint64 latency)
+{
+	preload_stats.batches++;
+	preload_stats.submenus += submenus;
+	preload_stats.calls += calls;
+	preload_stats.latency += latency;
+	g_debug("Preloaded %u submenus with %u calls in %" G_GINT64_FORMAT
+	        " us (total: %u batches, %u submenus, %u calls, %" G_GINT64_FORMAT " us)",
+	        submenus,
+	        calls,
+	        latency,
+	        preload_stats.batches,
+	        preload_stats.submenus,
+	        preload_stats.calls,
+	        preload_stats.latency);
+}
+
+static DBusMenuModel *dbus_menu_model_find_submenu(DBusMenuModel *menu, uint item_id)
+{
+	DBusMenuItem *item = dbus_menu_model_find(menu, item_id);
+	return item != NULL ? dbus_menu_item_get_submenu(item) : NULL;
+}
+
+static void preload_fallback(DBusMenuModel *menu, GArray *ids)
+{
+	// Calls are pipelined: all of them are sent before any answer is received
+	for (uint i = 0; i < ids->len; i++)
+	{
+		DBusMenuModel *submenu =
+		    dbus_menu_model_find_submenu(menu, g_array_index(ids, gint32, i));
+		if (submenu != NULL)
+			dbus_menu_model_open(submenu);
+	}
+	preload_stats_add(ids->len, ids->len * 2, 0);
 }
 
-static void queue_emit_all(GQueue *queue)
+static void about_to_show_group_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
-	struct layout_data *index = NULL;
-	while ((index = (struct layout_data *)g_queue_pop_head(queue)))
-		g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, G_SOURCE_FUNC(queue_emit_now), index, g_free);
+	struct preload_data *data   = (struct preload_data *)user_data;
+	DBusMenuModel *menu         = data->menu;
+	g_autoptr(GError) error     = NULL;
+	g_autoptr(GVariant) updates = NULL;
+	g_autoptr(GVariant) errors  = NULL;
+	dbus_menu_xml_call_about_to_show_group_finish((DBusMenuXml *)(source_object),
+	                                              &updates,
+	                                              &errors,
+	                                              res,
+	                                              &error);
+	if (error != NULL)
+	{
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		{
+			if (g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+				g_object_set_data(source_object,
+				                  NO_GROUP_CALLS_QUARK_STR,
+				                  GINT_TO_POINTER(true));
+			g_debug("AboutToShowGroup failed: %s", error->message);
+			preload_fallback(menu, data->ids);
+		}
+	}
+	else
+	{
+		preload_stats_add(data->ids->len, 2, g_get_monotonic_time() - data->start);
+		g_autoptr(GHashTable) need_update = g_hash_table_new(g_direct_hash, g_direct_equal);
+		GVariantIter iter;
+		gint32 id;
+		g_variant_iter_init(&iter, updates);
+		while (g_variant_iter_next(&iter, "i", &id))
+			g_hash_table_add(need_update, GINT_TO_POINTER(id));
+		for (uint i = 0; i < data->ids->len; i++)
+		{
+			id                     = g_array_index(data->ids, gint32, i);
+			DBusMenuModel *submenu = dbus_menu_model_find_submenu(menu, id);
+			if (submenu == NULL)
+				continue;
+			if (g_hash_table_contains(need_update, GINT_TO_POINTER(id)) ||
+			    dbus_menu_model_is_layout_update_required(submenu))
+				dbus_menu_model_update_layout(submenu);
+		}
+	}
+	g_array_unref(data->ids);
+	g_object_unref(data->menu);
+	g_free(data);
 }
 
-static bool preload_idle(DBusMenuItem *item)
+/* It is a preload hack. If this is a toplevel menu, we need to fetch menu under toplevel to
+ * avoid menu jumping bug. All submenus parsed in one pass are opened together: with
+ * EventGroup and AboutToShowGroup if client supports them, by pipelined calls otherwise.
+ */
+static bool preload_flush(DBusMenuModel *menu)
 {
-	dbus_menu_item_preload(item);
+	menu->preload_source   = 0;
+	g_autoptr(GArray) ids  = g_array_new(false, false, sizeof(gint32));
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init(&iter, menu->preload_ids);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+	{
+		gint32 id              = GPOINTER_TO_INT(key);
+		DBusMenuModel *submenu = dbus_menu_model_find_submenu(menu, id);
+		// Submenus from full-depth layout are already here
+		if (submenu != NULL && dbus_menu_model_is_layout_update_required(submenu))
+			g_array_append_val(ids, id);
+	}
+	g_hash_table_remove_all(menu->preload_ids);
+	if (ids->len == 0 || !DBUS_MENU_IS_XML(menu->xml))
+		return G_SOURCE_REMOVE;
+	if (ids->len == 1 || g_object_get_data(G_OBJECT(menu->xml), NO_GROUP_CALLS_QUARK_STR))
+	{
+		preload_fallback(menu, ids);
+		return G_SOURCE_REMOVE;
+	}
+	GVariantBuilder events;
+	g_variant_builder_init(&events, G_VARIANT_TYPE("a(isvu)"));
+	for (uint i = 0; i < ids->len; i++)
+		g_variant_builder_add(&events,
+		                      "(isvu)",
+		                      g_array_index(ids, gint32, i),
+		                      "opened",
+		                      g_variant_new_int32(0),
+		                      (guint32)CURRENT_TIME);
+	// Use opened before actual open. For Firefox. We do not need idErrors, so no reply.
+	dbus_menu_xml_call_event_group(menu->xml,
+	                               g_variant_builder_end(&events),
+	                               menu->cancellable,
+	                               NULL,
+	                               NULL);
+	struct preload_data *data = g_new0(struct preload_data, 1);
+	data->menu                = g_object_ref(menu);
+	data->ids                 = g_array_ref(ids);
+	data->start               = g_get_monotonic_time();
+	GVariant *id_array = g_variant_new_fixed_array(G_VARIANT_TYPE_INT32,
+	                                               ids->data,
+	                                               ids->len,
+	                                               sizeof(gint32));
+	dbus_menu_model_call(menu,
+	                     "AboutToShowGroup",
+	                     g_variant_new_tuple(&id_array, 1),
+	                     about_to_show_group_cb,
+	                     data);
 	return G_SOURCE_REMOVE;
 }
 
@@ -202,21 +423,135 @@ static void menu_item_copy_and_load(DBusMenuModel *menu, DBusMenuItem *old, DBus
 {
 	bool new_submenu = dbus_menu_item_copy_submenu(old, new_item, menu);
 	dbus_menu_item_generate_action(new_item, menu);
-	/* It is a preload hack. If this is a toplevel menu, we need to fetch menu under toplevel to
-	 * avoid menu jumping bug. Now we need to use it for all menus - no menus are preloaded,
-	 * AFAIK. But always enabled make sense only for submenus.
-	 */
+	// Submenus are always enabled, because they are preloaded
 	dbus_menu_item_update_enabled(new_item, new_submenu || new_item->enabled);
 	new_item->toggled = true;
-	g_timeout_add_full(100, 300, (GSourceFunc)preload_idle, new_item, NULL);
+	if (new_item->action_type != DBUS_MENU_ACTION_SUBMENU)
+		return;
+	// Items are not indexed yet, so keep ids and resolve them on flush
+	g_hash_table_add(menu->preload_ids, GUINT_TO_POINTER(new_item->id));
+	// All submenus of one parse pass are collected before the flush. Low priority keeps
+	// it behind pending parses and item refreshes, which may add more submenus.
+	if (!menu->preload_source)
+		menu->preload_source =
+		    g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)preload_flush, menu, NULL);
+}
+
+// Serials of section items, one array per section
+static GPtrArray *dbus_menu_model_get_serials(DBusMenuModel *menu)
+{
+	GPtrArray *ret  = g_ptr_array_new_with_free_func((GDestroyNotify)g_array_unref);
+	GArray *section = NULL;
+	for (GSequenceIter *iter = g_sequence_get_begin_iter(menu->items);
+	     !g_sequence_iter_is_end(iter);
+	     iter = g_sequence_iter_next(iter))
+	{
+		DBusMenuItem *item = (DBusMenuItem *)g_sequence_get(iter);
+		if (item->place == -1)
+		{
+			section = g_array_new(false, false, sizeof(uint));
+			g_ptr_array_add(ret, section);
+		}
+		else if (section != NULL)
+		{
+			g_array_append_val(section, item->serial);
+		}
+	}
+	return ret;
+}
+
+/* Unchanged items keep their serials, so serials found in both arrays (in the same order) are
+ * anchors. Every run between anchors is one items-changed range. Ranges are emitted from left
+ * to right with positions in the new layout, which is what listeners see after each emission.
+ */
+G_GNUC_INTERNAL void dbus_menu_model_emit_section_diff(GMenuModel *section, GArray *old_serials,
+                                                      GArray *new_serials)
+{
+	if (old_serials->len == new_serials->len &&
+	    !memcmp(old_serials->data, new_serials->data, old_serials->len * sizeof(uint)))
+		return;
+	g_autoptr(GHashTable) old_places = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (uint i = 0; i < old_serials->len; i++)
+		g_hash_table_insert(old_places,
+		                    GUINT_TO_POINTER(g_array_index(old_serials, uint, i)),
+		                    GUINT_TO_POINTER(i + 1));
+	uint old_pos = 0, new_start = 0;
+	for (uint j = 0; j <= new_serials->len; j++)
+	{
+		uint anchor = old_serials->len;
+		if (j < new_serials->len)
+		{
+			uint serial = g_array_index(new_serials, uint, j);
+			uint place  = GPOINTER_TO_UINT(
+                            g_hash_table_lookup(old_places, GUINT_TO_POINTER(serial)));
+			// Not found or moved backwards, so it is an added item
+			if (place == 0 || place - 1 < old_pos)
+				continue;
+			anchor = place - 1;
+		}
+		uint removed = anchor - old_pos;
+		uint added   = j - new_start;
+		if (removed > 0 || added > 0)
+			g_menu_model_items_changed(section, new_start, removed, added);
+		old_pos   = anchor + 1;
+		new_start = j + 1;
+	}
+}
+
+static void emit_layout_diff(DBusMenuModel *menu, GPtrArray *old_serials)
+{
+	g_autoptr(GPtrArray) new_serials = dbus_menu_model_get_serials(menu);
+	uint common                      = MIN(old_serials->len, new_serials->len);
+	for (uint i = 0; i < common; i++)
+	{
+		// Section headers are kept between layouts, so are section models
+		DBusMenuItem *header = dbus_menu_model_find_section(menu, i);
+		GMenuModel *section  = dbus_menu_item_get_link(header, G_MENU_LINK_SECTION);
+		dbus_menu_model_emit_section_diff(section,
+		                                  g_ptr_array_index(old_serials, i),
+		                                  g_ptr_array_index(new_serials, i));
+	}
+	// New sections are queried by listeners, so we need to notify only about them
+	if (old_serials->len != new_serials->len)
+		g_menu_model_items_changed(G_MENU_MODEL(menu),
+		                           common,
+		                           old_serials->len - common,
+		                           new_serials->len - common);
+}
+
+/* Full-depth layouts also carry children of submenus, so submenus are parsed in place and
+ * keep fetching full depth. A submenu without children is dynamic: it is filled by the
+ * client on AboutToShow, so it is fetched level by level.
+ */
+static void layout_parse_submenu(DBusMenuModel *menu, DBusMenuItem *item, GVariant *layout)
+{
+	if (item == NULL)
+		return;
+	DBusMenuModel *submenu = dbus_menu_item_get_submenu(item);
+	if (submenu == NULL)
+		return;
+	g_autoptr(GVariant) children = g_variant_get_child_value(layout, 2);
+	if (g_variant_n_children(children) == 0)
+		return;
+	submenu->layout_depth           = -1;
+	submenu->layout_update_required = false;
+	submenu->layout_revision        = menu->layout_revision;
+	layout_parse(submenu, layout);
 }
 
-// We deal only with layouts with depth 1 (not all)
+/* Layouts with depth 1 are parsed as is, deeper ones are passed to submenus. Layout is
+ * walked by child indexes: GDBus replies are already in tree form, so taking a child is
+ * only a reference, while g_variant_get() with a format string would unpack every node
+ * into new values, including children and root properties which are not used here.
+ *
+ * Items are matched to current ones by id wherever they are, so inserting, removing or
+ * moving an item keeps serials of all others, and emit_layout_diff() reports only what has
+ * changed. Current items stay where they are until the new order is complete: indexes are
+ * valid for nested submenu parses and their signal handlers, and items which were not taken
+ * are freed only when the new layout is in place.
+ */
 static void layout_parse(DBusMenuModel *menu, GVariant *layout)
 {
-	guint id;
-	GVariant *props;
-	GVariant *items;
 	if (!g_variant_is_of_type(layout, G_VARIANT_TYPE("(ia{sv}av)")))
 	{
 		g_warning(
@@ -229,171 +564,162 @@ static void layout_parse(DBusMenuModel *menu, GVariant *layout)
 	//We really should not run if we are not a menu
 	if(!DBUS_MENU_IS_MODEL(menu))
 		return;
-	g_variant_get(layout, "(i@a{sv}@av)", &id, &props, &items);
-	g_variant_unref(props);
-	GVariantIter iter;
-	GVariant *child;
-	// Start parsing. We need to track section number, and also GSequenceIter to
-	// current section. Also we track change position, number of added and removed
-	// items for current section
+	pending_changes_flush_now(menu);
+	g_autoptr(GVariant) items        = g_variant_get_child_value(layout, 2);
+	gsize n_items                    = g_variant_n_children(items);
+	g_autoptr(GPtrArray) old_serials = dbus_menu_model_get_serials(menu);
+	// New order of items, section headers included
+	g_autoptr(GPtrArray) order  = g_ptr_array_sized_new(n_items + 1);
+	g_autoptr(GHashTable) taken = g_hash_table_new(g_direct_hash, g_direct_equal);
 	uint section_num            = 0;
 	uint place                  = 0;
-	uint old_sections           = g_menu_model_get_n_items(G_MENU_MODEL(menu));
-	uint added                  = 0;
-	int change_pos              = -1;
-	GSequenceIter *current_iter = g_sequence_get_begin_iter(menu->items);
-	g_variant_iter_init(&iter, items);
-	while ((child = g_variant_iter_next_value(&iter)))
+	uint reused                 = 0;
+	uint allocated              = 0;
+	DBusMenuItem *header        = dbus_menu_model_find_section(menu, 0);
+	g_ptr_array_add(order, header);
+	g_hash_table_add(taken, header);
+	for (gsize i = 0; i < n_items; i++)
 	{
-		GVariant *value = g_variant_get_variant(child);
-		guint cid;
-		GVariant *cprops;
-		GVariant *citems;
-		g_variant_get(value, "(i@a{sv}@av)", &cid, &cprops, &citems);
-		g_variant_unref(citems);
-
-		DBusMenuItem *old      = NULL;
+		g_autoptr(GVariant) child  = g_variant_get_child_value(items, i);
+		g_autoptr(GVariant) value  = g_variant_get_variant(child);
+		g_autoptr(GVariant) cidv   = g_variant_get_child_value(value, 0);
+		g_autoptr(GVariant) cprops = g_variant_get_child_value(value, 1);
+		guint cid                  = (guint)g_variant_get_int32(cidv);
+
+		// Headers are matched by section number, and every item is taken only once
+		DBusMenuItem *old = dbus_menu_model_find(menu, cid);
+		if (old != NULL && (old->place < 0 || g_hash_table_contains(taken, old)))
+			old = NULL;
+		bool is_reused = old != NULL && dbus_menu_item_is_reusable(old, cid, cprops);
+		if (is_reused && dbus_menu_item_update_props(old, cprops, menu))
+			dbus_menu_item_bump_serial(old);
+		// Item which became a Firefox stub goes the full way below, and it is dropped there
+		if (is_reused && !dbus_menu_item_is_firefox_stub(old))
+		{
+			g_ptr_array_add(order, old);
+			g_hash_table_add(taken, old);
+			layout_parse_submenu(menu, old, value);
+			place++;
+			reused++;
+			continue;
+		}
+
+		allocated++;
 		DBusMenuItem *new_item = dbus_menu_item_new(cid, menu, cprops);
-		// We receive a section (separator or x-kde-title)
+		// We receive a section (separator or x-kde-title). Empty sections are skipped.
 		if (new_item->action_type == DBUS_MENU_ACTION_SECTION)
 		{
-			bool is_valid_section = !new_item->toggled && place > 0;
-			// Section is valid, so, parse it
-			if (is_valid_section)
+			if (new_item->toggled || place == 0)
 			{
-				// Do some common tasks: increment section_num and iter
-				++section_num;
-				place--;
-				new_item->section_num = section_num;
-				new_item->place       = -1;
-				GSequenceIter *old_iter =
-				    g_sequence_lookup(menu->items,
-				                      new_item,
-				                      dbus_menu_model_sort_func,
-				                      NULL);
-				if (!old_iter)
-				{
-					g_hash_table_insert(
-					    new_item->links,
-					    G_MENU_LINK_SECTION,
-					    dbus_menu_section_model_new(menu, section_num));
-					old_iter =
-					    g_sequence_insert_sorted(menu->items,
-					                             new_item,
-					                             dbus_menu_model_sort_func,
-					                             NULL);
-				}
-				else
-					dbus_menu_item_free(new_item);
-				old =
-				    (DBusMenuItem *)g_sequence_get(g_sequence_iter_prev(old_iter));
-				int delta                 = old->place - place;
-				GSequenceIter *place_iter = g_sequence_iter_move(old_iter, -delta);
-				// Cleanup all items in prev section (if there is more items than
-				// current)
-				if (delta > 0)
-					g_sequence_remove_range(place_iter, old_iter);
-				// Section signal will do it for us, do not send additional one
-				// Update current_section and reset current_iter and added to new
-				// section
-				current_iter = g_sequence_iter_next(old_iter);
-				added        = 0;
-				change_pos   = -1;
-				place        = 0;
-			}
-			// If section was invalid, just free received item.
-			else
 				dbus_menu_item_free(new_item);
-		}
-		else if (!dbus_menu_item_is_firefox_stub(new_item))
-		{
-			new_item->section_num   = section_num;
-			new_item->place         = place;
-			GSequenceIter *old_iter = g_sequence_lookup(menu->items,
-			                                            new_item,
-			                                            dbus_menu_model_sort_func,
-			                                            NULL);
-			// There is no old item on this place
-			if (!old_iter)
+				continue;
+			}
+			section_num++;
+			place = 0;
+			// Section models are kept between layouts, as listeners hold them
+			header = dbus_menu_model_find_section(menu, section_num);
+			if (header != NULL)
 			{
-				if (!added)
-					change_pos = change_pos < 0 ? place : change_pos;
-				menu_item_copy_and_load(menu, NULL, new_item);
-				current_iter = g_sequence_insert_sorted(menu->items,
-				                                        new_item,
-				                                        dbus_menu_model_sort_func,
-				                                        NULL);
-				added++;
+				dbus_menu_item_free(new_item);
+				g_hash_table_add(taken, header);
 			}
-			// If there is an old item exists, we need to check this properties
 			else
 			{
-				old = (DBusMenuItem *)g_sequence_get(old_iter);
-				// We should compare properties of old and new item
-				bool diff    = !dbus_menu_item_compare_immutable(old, new_item);
-				dbus_menu_item_update_props(old, cprops);
-				if (diff)
-				{
-					// Immutable properties was different, replace menu item
-					menu_item_copy_and_load(menu, old, new_item);
-					g_sequence_remove(old_iter);
-					current_iter =
-					    g_sequence_insert_sorted(menu->items,
-					                             new_item,
-					                             dbus_menu_model_sort_func,
-					                             NULL);
-				}
-				else
-				{
-					// Just free unneeded item
-					dbus_menu_item_free(new_item);
-				}
+				header = new_item;
+				dbus_menu_item_set_link(
+				    header,
+				    G_MENU_LINK_SECTION,
+				    G_MENU_MODEL(dbus_menu_section_model_new(menu, section_num)));
 			}
-			current_iter = g_sequence_iter_next(current_iter);
-			place++;
+			g_ptr_array_add(order, header);
 		}
-		else
-			// Just free unnedeed item
+		else if (dbus_menu_item_is_firefox_stub(new_item))
 			dbus_menu_item_free(new_item);
-		g_variant_unref(cprops);
-		g_variant_unref(value);
-		g_variant_unref(child);
+		else
+		{
+			// Item which changed its type still keeps a submenu model it had
+			menu_item_copy_and_load(menu, old, new_item);
+			g_ptr_array_add(order, new_item);
+			layout_parse_submenu(menu, new_item, value);
+			place++;
+		}
 	}
-	section_num++;
-	int secdiff = old_sections - section_num;
-	if (secdiff > 0)
+
+	GSequence *old_items = menu->items;
+	menu->items          = g_sequence_new(NULL);
+	int item_section     = -1;
+	int item_place       = -1;
+	for (uint i = 0; i < order->len; i++)
 	{
-		GSequenceIter *section_iter = dbus_menu_model_find_place(menu, section_num, -1);
-		g_sequence_remove_range(section_iter, g_sequence_get_end_iter(menu->items));
+		DBusMenuItem *item = (DBusMenuItem *)g_ptr_array_index(order, i);
+		if (item->action_type == DBUS_MENU_ACTION_SECTION)
+		{
+			item_section++;
+			item_place = -1;
+		}
+		item->section_num = item_section;
+		item->place       = item_place++;
+		g_sequence_append(menu->items, item);
 	}
-	// We need to manage last section's changes. And check its validity
-	if (secdiff >= 0)
+	dbus_menu_model_reindex(menu);
+	for (GSequenceIter *iter = g_sequence_get_begin_iter(old_items);
+	     !g_sequence_iter_is_end(iter);
+	     iter = g_sequence_iter_next(iter))
 	{
-		place--;
-		DBusMenuItem *old = (DBusMenuItem *)g_sequence_get(
-		    g_sequence_iter_prev(g_sequence_get_end_iter(menu->items)));
-		int delta                 = old->place - place;
-		GSequenceIter *last_iter  = g_sequence_get_end_iter(menu->items);
-		GSequenceIter *place_iter = g_sequence_iter_move(last_iter, -delta);
-
-		// Cleanup all items in prev section (if there is more items than
-		// current)
-		if (delta > 0)
-			g_sequence_remove_range(place_iter, last_iter);
+		DBusMenuItem *item = (DBusMenuItem *)g_sequence_get(iter);
+		if (!g_hash_table_contains(taken, item))
+			dbus_menu_item_free(item);
 	}
-	g_variant_unref(items);
-	// Update all layout
-	g_menu_model_items_changed(G_MENU_MODEL(menu), 0, old_sections, section_num);
+	g_sequence_free(old_items);
+	emit_layout_diff(menu, old_serials);
+	g_debug("Layout of %u parsed: %u items updated in place, %u allocated",
+	        menu->parent_id,
+	        reused,
+	        allocated);
+}
+
+static void dbus_menu_model_parse_current(DBusMenuModel *menu)
+{
+	layout_parse(menu, menu->current_layout);
+	menu->last_parse = g_get_monotonic_time();
+	menu->parse_count++;
 }
 
 static bool get_layout_idle(DBusMenuModel *self)
 {
 	g_return_val_if_fail(DBUS_MENU_IS_MODEL(self), G_SOURCE_REMOVE);
-	layout_parse(self, self->current_layout);
+	dbus_menu_model_parse_current(self);
 	self->parse_pending = 0;
 	return G_SOURCE_REMOVE;
 }
 
+/* First layout and layouts after a quiet period are parsed at once. Layouts arriving
+ * faster than parse_interval are collapsed: only the latest one is parsed, when the
+ * interval since the previous parse is over.
+ */
+static void dbus_menu_model_schedule_parse(DBusMenuModel *menu)
+{
+	if (menu->parse_pending)
+		return;
+	gint64 elapsed = (g_get_monotonic_time() - menu->last_parse) / 1000;
+	if (menu->parse_count == 0 || elapsed >= menu->parse_interval)
+	{
+		dbus_menu_model_parse_current(menu);
+		g_debug("Layout of %u parsed at once, %u parses", menu->parent_id, menu->parse_count);
+		return;
+	}
+	uint delay          = menu->parse_interval - (uint)elapsed;
+	menu->parse_pending = g_timeout_add_full(G_PRIORITY_HIGH,
+	                                         delay,
+	                                         (GSourceFunc)get_layout_idle,
+	                                         g_object_ref(menu),
+	                                         g_object_unref);
+	g_debug("Layout of %u parse delayed by %u ms, %u parses",
+	        menu->parent_id,
+	        delay,
+	        menu->parse_count);
+}
+
 static void get_layout_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
 	guint revision;
@@ -415,63 +741,186 @@ static void get_layout_cb(GObject *source_object, GAsyncResult *res, gpointer us
 		return;
 	}
 	menu->layout_update_required = false;
-	if (!menu->parse_pending)
-		menu->parse_pending = g_timeout_add_full(G_PRIORITY_HIGH,
-		                                         100,
-		                                         (GSourceFunc)get_layout_idle,
-		                                         g_object_ref(menu),
-		                                         g_object_unref);
+	menu->current_revision       = MAX(menu->current_revision, revision);
+	dbus_menu_layout_cache_store(g_dbus_proxy_get_name(G_DBUS_PROXY(source_object)),
+	                             g_dbus_proxy_get_object_path(G_DBUS_PROXY(source_object)),
+	                             menu->parent_id,
+	                             menu->layout_depth,
+	                             revision,
+	                             menu->current_layout);
+	// Layout shown from cache is still actual, so there is nothing to parse. Some clients
+	// do not track revisions at all and always report 0, so their layouts are parsed anyway.
+	bool is_cache_actual = menu->layout_cached && revision > 0 &&
+	                       menu->layout_revision == revision && !menu->parse_pending;
+	menu->layout_cached   = false;
+	menu->layout_revision = revision;
+	if (is_cache_actual)
+	{
+		g_debug("Cached layout of %u is actual, revision %u", menu->parent_id, revision);
+		g_clear_pointer(&menu->current_layout, g_variant_unref);
+		g_object_unref(menu);
+		return;
+	}
+	dbus_menu_model_schedule_parse(menu);
 	g_object_unref(menu);
 }
 
-static void dbus_menu_update_item_properties_from_layout_sync(DBusMenuModel *menu,
-                                                              DBusMenuItem *item, int sect_n,
-                                                              int pos)
+static void item_layout_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
-	g_return_if_fail(DBUS_MENU_IS_MODEL(menu));
-
-	if (menu->parse_pending)
-	{
-		dbus_menu_model_update_layout(menu);
-		return;
-	}
-	g_autoptr(GVariant) props      = NULL;
-	g_autoptr(GVariant) items      = NULL;
-	g_autoptr(GVariant) layout     = NULL;
-	g_autoptr(GError) error        = NULL;
-	g_autoptr(GQueue) signal_queue = g_queue_new();
+	DBusMenuModel *menu        = DBUS_MENU_MODEL(user_data);
+	g_autoptr(GVariant) props  = NULL;
+	g_autoptr(GVariant) layout = NULL;
+	g_autoptr(GError) error    = NULL;
 	guint id, revision;
-	dbus_menu_xml_call_get_layout_sync(menu->xml,
-	                                   item->id,
-	                                   0,
-	                                   property_names,
-	                                   &revision,
-	                                   &layout,
-	                                   menu->cancellable,
-	                                   &error);
+	dbus_menu_xml_call_get_layout_finish((DBusMenuXml *)(source_object),
+	                                     &revision,
+	                                     &layout,
+	                                     res,
+	                                     &error);
 	if (error != NULL)
 	{
 		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
 			g_warning("%s", error->message);
+		g_object_unref(menu);
 		return;
 	}
-	g_variant_get(layout, "(i@a{sv}@av)", &id, &props, &items);
-	bool is_item_updated = dbus_menu_item_update_props(item, props);
-	if (is_item_updated)
-		add_signal_to_queue(menu, signal_queue, sect_n, pos, 1, 1);
-	queue_emit_all(signal_queue);
+	g_variant_get_child(layout, 0, "i", &id);
+	props = g_variant_get_child_value(layout, 1);
+	// Item could be replaced by a layout parse while the call was in flight
+	DBusMenuItem *item = menu->parse_pending ? NULL : dbus_menu_model_find(menu, id);
+	if (item != NULL && dbus_menu_item_update_props(item, props, menu))
+		dbus_menu_model_queue_change(menu, item->section_num, item->place);
+	g_object_unref(menu);
+}
+
+/* LayoutUpdated for single items is collected during a main loop iteration, so every item
+ * is requested once, however many signals were received for it.
+ */
+static bool refresh_items_flush(DBusMenuModel *menu)
+{
+	menu->refresh_source = 0;
+	if (!DBUS_MENU_IS_XML(menu->xml))
+	{
+		g_hash_table_remove_all(menu->refresh_ids);
+		return G_SOURCE_REMOVE;
+	}
+	// Whole layout is parsed soon anyway, so refresh it instead of items
+	if (menu->parse_pending)
+	{
+		g_hash_table_remove_all(menu->refresh_ids);
+		dbus_menu_model_update_layout(menu);
+		return G_SOURCE_REMOVE;
+	}
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init(&iter, menu->refresh_ids);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+	{
+		dbus_menu_model_call(menu,
+		                     "GetLayout",
+		                     g_variant_new("(ii^as)",
+		                                   GPOINTER_TO_INT(key),
+		                                   0,
+		                                   property_names),
+		                     item_layout_cb,
+		                     g_object_ref(menu));
+		g_hash_table_iter_remove(&iter);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void dbus_menu_model_queue_item_refresh(DBusMenuModel *menu, uint id)
+{
+	g_hash_table_add(menu->refresh_ids, GUINT_TO_POINTER(id));
+	if (!menu->refresh_source)
+		menu->refresh_source = g_idle_add_full(G_PRIORITY_HIGH_IDLE,
+		                                       (GSourceFunc)refresh_items_flush,
+		                                       menu,
+		                                       NULL);
 }
 
 G_GNUC_INTERNAL void dbus_menu_model_update_layout(DBusMenuModel *menu)
 {
 	g_return_if_fail(DBUS_MENU_IS_MODEL(menu));
-	dbus_menu_xml_call_get_layout(menu->xml,
-	                              menu->parent_id,
-	                              1,
-	                              property_names,
-	                              menu->cancellable,
-	                              get_layout_cb,
-	                              g_object_ref(menu));
+	dbus_menu_model_call(menu,
+	                     "GetLayout",
+	                     g_variant_new("(ii^as)",
+	                                   menu->parent_id,
+	                                   menu->layout_depth,
+	                                   property_names),
+	                     get_layout_cb,
+	                     g_object_ref(menu));
+}
+
+// Parses layout at once, as if the client sent it. Tests and benchmarks feed layouts this way.
+G_GNUC_INTERNAL void dbus_menu_model_apply_layout(DBusMenuModel *menu, GVariant *layout)
+{
+	g_return_if_fail(DBUS_MENU_IS_MODEL(menu));
+	layout_parse(menu, layout);
+}
+
+static void about_to_show_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	if (!DBUS_MENU_IS_MODEL(user_data))
+		return;
+	DBusMenuModel *menu     = DBUS_MENU_MODEL(user_data);
+	g_autoptr(GError) error = NULL;
+	gboolean need_update    = false;
+	dbus_menu_xml_call_about_to_show_finish((DBusMenuXml *)(source_object),
+	                                        &need_update,
+	                                        res,
+	                                        &error);
+	if (error != NULL)
+	{
+		if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		{
+			g_object_unref(menu);
+			return;
+		}
+		// Client may not implement AboutToShow or be too slow to answer, refetch anyway
+		g_debug("AboutToShow for %u failed: %s", menu->parent_id, error->message);
+		need_update = true;
+	}
+	if (need_update || menu->layout_update_required)
+		dbus_menu_model_update_layout(menu);
+	g_object_unref(menu);
+}
+
+G_GNUC_INTERNAL void dbus_menu_model_open(DBusMenuModel *menu)
+{
+	g_return_if_fail(DBUS_MENU_IS_MODEL(menu));
+	if (!DBUS_MENU_IS_XML(menu->xml))
+		return;
+	// Use opened before actual open. For Firefox. Event has no reply, so it is only queued,
+	// and the bus keeps it ordered before AboutToShow.
+	dbus_menu_xml_call_event(menu->xml,
+	                         menu->parent_id,
+	                         "opened",
+	                         g_variant_new("v", g_variant_new_int32(0)),
+	                         CURRENT_TIME,
+	                         menu->cancellable,
+	                         NULL,
+	                         NULL);
+	dbus_menu_model_call(menu,
+	                     "AboutToShow",
+	                     g_variant_new("(i)", menu->parent_id),
+	                     about_to_show_cb,
+	                     g_object_ref(menu));
+}
+
+G_GNUC_INTERNAL void dbus_menu_model_close(DBusMenuModel *menu)
+{
+	g_return_if_fail(DBUS_MENU_IS_MODEL(menu));
+	if (!DBUS_MENU_IS_XML(menu->xml))
+		return;
+	dbus_menu_xml_call_event(menu->xml,
+	                         menu->parent_id,
+	                         "closed",
+	                         g_variant_new("v", g_variant_new_int32(0)),
+	                         CURRENT_TIME,
+	                         menu->cancellable,
+	                         NULL,
+	                         NULL);
 }
 
 static void layout_updated_cb(DBusMenuXml *proxy, guint revision, gint parent, DBusMenuModel *menu)
@@ -485,12 +934,8 @@ static void layout_updated_cb(DBusMenuXml *proxy, guint revision, gint parent, D
 		menu->current_revision = revision;
 		return;
 	}
-	DBusMenuItem *item = dbus_menu_model_find(menu, (uint)parent);
-	if (item != NULL)
-		dbus_menu_update_item_properties_from_layout_sync(menu,
-		                                                  item,
-		                                                  item->section_num,
-		                                                  item->place);
+	if (dbus_menu_model_find(menu, (uint)parent) != NULL)
+		dbus_menu_model_queue_item_refresh(menu, (uint)parent);
 }
 
 static void item_activation_requested_cb(DBusMenuXml *proxy, gint id, guint timestamp,
@@ -503,8 +948,7 @@ static void item_activation_requested_cb(DBusMenuXml *proxy, gint id, guint time
 	g_debug("activation requested: id - %d, timestamp - %d", id, timestamp);
 }
 
-static void items_properties_loop(DBusMenuModel *menu, GVariant *up_props, GQueue *signal_queue,
-                                  bool is_removal)
+static void items_properties_loop(DBusMenuModel *menu, GVariant *up_props, bool is_removal)
 {
 	GVariantIter iter;
 	guint id;
@@ -524,15 +968,12 @@ static void items_properties_loop(DBusMenuModel *menu, GVariant *up_props, GQueu
 			else
 			{
 				is_item_updated = !is_removal
-				                      ? dbus_menu_item_update_props(item, props)
+				                      ? dbus_menu_item_update_props(item, props, menu)
 				                      : dbus_menu_item_remove_props(item, props);
 				if (is_item_updated)
-					add_signal_to_queue(menu,
-					                    signal_queue,
-					                    item->section_num,
-					                    item->place,
-					                    1,
-					                    1);
+					dbus_menu_model_queue_change(menu,
+					                             item->section_num,
+					                             item->place);
 			}
 		}
 	}
@@ -545,10 +986,25 @@ static void items_properties_updated_cb(DBusMenuXml *proxy, GVariant *updated_pr
 		return;
 	if (menu->parse_pending)
 		return;
-	g_autoptr(GQueue) signal_queue = g_queue_new();
-	items_properties_loop(menu, updated_props, signal_queue, false);
-	items_properties_loop(menu, removed_props, signal_queue, true);
-	queue_emit_all(signal_queue);
+	items_properties_loop(menu, updated_props, false);
+	items_properties_loop(menu, removed_props, true);
+}
+
+static void dbus_menu_model_load_cached_layout(DBusMenuModel *menu)
+{
+	uint revision              = 0;
+	g_autoptr(GVariant) layout =
+	    dbus_menu_layout_cache_lookup(g_dbus_proxy_get_name(G_DBUS_PROXY(menu->xml)),
+	                                  g_dbus_proxy_get_object_path(G_DBUS_PROXY(menu->xml)),
+	                                  menu->parent_id,
+	                                  menu->layout_depth,
+	                                  &revision);
+	if (layout == NULL)
+		return;
+	g_debug("Layout of %u is loaded from cache, revision %u", menu->parent_id, revision);
+	menu->layout_cached   = true;
+	menu->layout_revision = revision;
+	layout_parse(menu, layout);
 }
 
 static void on_xml_property_changed(DBusMenuModel *model)
@@ -565,6 +1021,10 @@ static void on_xml_property_changed(DBusMenuModel *model)
 	                 "item-activation-requested",
 	                 G_CALLBACK(item_activation_requested_cb),
 	                 model);
+	// Cached layout is shown at once, actual one is still fetched when needed. During
+	// construction parent-id and section header are not set yet, so constructed() loads it.
+	if (g_sequence_get_length(model->items) > 0)
+		dbus_menu_model_load_cached_layout(model);
 	if (model->parent_id == 0)
 		dbus_menu_model_update_layout(model);
 }
@@ -581,7 +1041,11 @@ G_GNUC_INTERNAL DBusMenuModel *dbus_menu_model_new(uint parent_id, DBusMenuModel
 	                                                   action_group,
 	                                                   NULL);
 	if (parent != NULL)
+	{
+		ret->parse_interval = parent->parse_interval;
+		ret->timeout        = parent->timeout;
 		g_object_bind_property(parent, "xml", ret, "xml", G_BINDING_SYNC_CREATE);
+	}
 	return ret;
 }
 
@@ -646,45 +1110,119 @@ G_GNUC_INTERNAL bool dbus_menu_model_is_layout_update_required(DBusMenuModel *mo
 	return model->layout_update_required;
 }
 
-static DBusMenuItem *dbus_menu_model_find(DBusMenuModel *menu, uint item_id)
+G_GNUC_INTERNAL void dbus_menu_model_set_prefetch(DBusMenuModel *model, bool prefetch)
 {
+	model->layout_depth = prefetch ? -1 : 1;
+}
+
+// Submenus created after this call inherit the interval
+G_GNUC_INTERNAL void dbus_menu_model_set_parse_interval(DBusMenuModel *model, uint interval)
+{
+	model->parse_interval = interval;
+}
+
+// Submenus created after this call inherit the timeout
+G_GNUC_INTERNAL void dbus_menu_model_set_timeout(DBusMenuModel *model, int timeout)
+{
+	model->timeout = timeout;
+}
+
+/* Items are owned by menu->items, so index tables hold only borrowed pointers. Items are
+ * freed only by layout_parse(), after the new layout is in place and indexed, so indexes
+ * never point to freed items.
+ */
+static void dbus_menu_model_reindex(DBusMenuModel *menu)
+{
+	g_hash_table_remove_all(menu->ids);
+	g_ptr_array_set_size(menu->sections, 0);
+	g_array_set_size(menu->section_sizes, 0);
 	for (GSequenceIter *iter = g_sequence_get_begin_iter(menu->items);
 	     !g_sequence_iter_is_end(iter);
 	     iter = g_sequence_iter_next(iter))
 	{
 		DBusMenuItem *item = (DBusMenuItem *)g_sequence_get(iter);
-		if (item->id == item_id)
-			return item;
+		// Keep first match, section 0 header shares id with parent
+		if (!g_hash_table_contains(menu->ids, GUINT_TO_POINTER(item->id)))
+			g_hash_table_insert(menu->ids, GUINT_TO_POINTER(item->id), item);
+		if ((uint)item->section_num >= menu->sections->len)
+		{
+			g_ptr_array_set_size(menu->sections, item->section_num + 1);
+			g_array_set_size(menu->section_sizes, item->section_num + 1);
+		}
+		if (item->place == -1)
+			g_ptr_array_index(menu->sections, item->section_num) = item;
+		else
+			g_array_index(menu->section_sizes, uint, item->section_num)++;
 	}
-	return NULL;
 }
 
+static DBusMenuItem *dbus_menu_model_find(DBusMenuModel *menu, uint item_id)
+{
+	return (DBusMenuItem *)g_hash_table_lookup(menu->ids, GUINT_TO_POINTER(item_id));
+}
+
+// Sequence is sorted by (section_num, place), so it is a binary search
 static GSequenceIter *dbus_menu_model_find_place(DBusMenuModel *menu, uint section_num, int place)
 {
-	for (GSequenceIter *iter = g_sequence_get_begin_iter(menu->items);
-	     !g_sequence_iter_is_end(iter);
-	     iter = g_sequence_iter_next(iter))
-	{
-		DBusMenuItem *item = (DBusMenuItem *)g_sequence_get(iter);
-		if (item->section_num == section_num && item->place == place)
-			return iter;
-	}
-	return NULL;
+	DBusMenuItem key = { .section_num = section_num, .place = place };
+	return g_sequence_lookup(menu->items, &key, dbus_menu_model_sort_func, NULL);
 }
 
 static DBusMenuItem *dbus_menu_model_find_section(DBusMenuModel *menu, uint section_num)
 {
-	return (DBusMenuItem *)g_sequence_get(dbus_menu_model_find_place(menu, section_num, -1));
+	if (section_num >= menu->sections->len)
+		return NULL;
+	return (DBusMenuItem *)g_ptr_array_index(menu->sections, section_num);
+}
+
+G_GNUC_INTERNAL DBusMenuItem *dbus_menu_model_get_item(DBusMenuModel *menu, uint item_id)
+{
+	return dbus_menu_model_find(menu, item_id);
+}
+
+G_GNUC_INTERNAL uint dbus_menu_model_get_section_n_items(DBusMenuModel *menu, uint section_num)
+{
+	if (section_num >= menu->section_sizes->len)
+		return 0;
+	return g_array_index(menu->section_sizes, uint, section_num);
+}
+
+G_GNUC_INTERNAL DBusMenuItem *dbus_menu_model_get_section_item(DBusMenuModel *menu,
+                                                               uint section_num, int place)
+{
+	GSequenceIter *iter = dbus_menu_model_find_place(menu, section_num, place);
+	return iter != NULL ? (DBusMenuItem *)g_sequence_get(iter) : NULL;
 }
 
 static void dbus_menu_model_init(DBusMenuModel *menu)
 {
 	menu->cancellable            = g_cancellable_new();
 	menu->parent_id              = UINT_MAX;
-	menu->items                  = g_sequence_new(dbus_menu_item_free);
+	// Items are moved between sequences on parse, so they are freed explicitly
+	menu->items                  = g_sequence_new(NULL);
+	menu->ids                    = g_hash_table_new(g_direct_hash, g_direct_equal);
+	menu->sections               = g_ptr_array_new();
+	menu->section_sizes          = g_array_new(false, true, sizeof(uint));
+	menu->preload_ids            = g_hash_table_new(g_direct_hash, g_direct_equal);
+	menu->preload_source         = 0;
+	menu->pending_changes        = g_hash_table_new_full(g_direct_hash,
+	                                                     g_direct_equal,
+	                                                     g_object_unref,
+	                                                     (GDestroyNotify)g_array_unref);
+	menu->pending_count          = 0;
+	menu->pending_source         = 0;
+	menu->refresh_ids            = g_hash_table_new(g_direct_hash, g_direct_equal);
+	menu->refresh_source         = 0;
 	menu->layout_update_required = true;
+	menu->layout_depth           = 1;
 	menu->parse_pending          = 0;
+	menu->parse_interval         = 100;
+	menu->timeout                = -1;
+	menu->parse_count            = 0;
+	menu->last_parse             = 0;
 	menu->current_revision       = 0;
+	menu->layout_revision        = 0;
+	menu->layout_cached          = false;
 }
 
 static void dbus_menu_model_constructed(GObject *object)
@@ -696,10 +1234,13 @@ static void dbus_menu_model_constructed(GObject *object)
 	    dbus_menu_item_new_first_section(menu->parent_id, menu->received_action_group);
 	first_section->section_num = 0;
 	first_section->place       = -1;
-	g_hash_table_insert(first_section->links,
-	                    G_MENU_LINK_SECTION,
-	                    dbus_menu_section_model_new(menu, 0));
+	dbus_menu_item_set_link(first_section,
+	                        G_MENU_LINK_SECTION,
+	                        G_MENU_MODEL(dbus_menu_section_model_new(menu, 0)));
 	g_sequence_insert_sorted(menu->items, first_section, dbus_menu_model_sort_func, NULL);
+	dbus_menu_model_reindex(menu);
+	if (DBUS_MENU_IS_XML(menu->xml))
+		dbus_menu_model_load_cached_layout(menu);
 }
 
 static void dbus_menu_model_finalize(GObject *object)
@@ -709,11 +1250,27 @@ static void dbus_menu_model_finalize(GObject *object)
 		g_signal_handlers_disconnect_by_data(menu->xml, menu);
 		g_clear_object(&menu->xml);
 	}
-	g_source_remove_by_user_data(menu);
+	if (menu->preload_source > 0)
+		g_source_remove(menu->preload_source);
+	menu->preload_source = 0;
+	if (menu->pending_source > 0)
+		g_source_remove(menu->pending_source);
+	menu->pending_source = 0;
+	if (menu->refresh_source > 0)
+		g_source_remove(menu->refresh_source);
+	menu->refresh_source = 0;
 	g_cancellable_cancel(menu->cancellable);
 	g_clear_object(&menu->cancellable);
-	g_clear_object(&menu->received_action_group);
+	g_clear_pointer(&menu->ids, g_hash_table_destroy);
+	g_clear_pointer(&menu->sections, g_ptr_array_unref);
+	g_clear_pointer(&menu->section_sizes, g_array_unref);
+	g_clear_pointer(&menu->preload_ids, g_hash_table_destroy);
+	g_clear_pointer(&menu->pending_changes, g_hash_table_destroy);
+	g_clear_pointer(&menu->refresh_ids, g_hash_table_destroy);
+	g_sequence_foreach(menu->items, (GFunc)dbus_menu_item_free, NULL);
 	g_clear_pointer(&menu->items, g_sequence_free);
+	// Items drop their actions, so the group must outlive them
+	g_clear_object(&menu->received_action_group);
 	g_clear_pointer(&menu->current_layout, g_variant_unref);
 
 	G_OBJECT_CLASS(dbus_menu_model_parent_class)->finalize(object);
@@ -759,9 +1316,11 @@ static void dbus_menu_model_class_init(DBusMenuModelClass *klass)
 	object_class->get_property = dbus_menu_model_get_property;
 	object_class->constructed  = dbus_menu_model_constructed;
 
-	model_class->is_mutable          = dbus_menu_model_is_mutable;
-	model_class->get_n_items         = dbus_menu_model_get_n_items;
-	model_class->get_item_attributes = dbus_menu_model_get_item_attributes;
-	model_class->get_item_links      = dbus_menu_model_get_item_links;
+	model_class->is_mutable               = dbus_menu_model_is_mutable;
+	model_class->get_n_items              = dbus_menu_model_get_n_items;
+	model_class->get_item_attributes      = dbus_menu_model_get_item_attributes;
+	model_class->get_item_links           = dbus_menu_model_get_item_links;
+	model_class->get_item_attribute_value = dbus_menu_model_get_item_attribute_value;
+	model_class->get_item_link            = dbus_menu_model_get_item_link;
 	install_properties(object_class);
 }
@@ -0,0 +1,216 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pool.h"
+
+/* Process-wide pool of menu proxies. Importers are recreated on every window switch, and
+ * windows of one application share the same menu owner, so one name watch and one proxy
+ * serve all importers of a (bus name, object path) pair. Unused entries are kept for a
+ * short time, so switching back and forth does not build them again.
+ */
+#define PROXY_POOL_EXPIRE_SECONDS 5
+
+typedef struct
+{
+	char *key;
+	char *bus_name;
+	char *object_path;
+	uint watch_id;
+	uint expire_source;
+	GCancellable *cancellable;
+	DBusMenuXml *proxy;
+	GSList *clients;
+} DBusMenuProxyEntry;
+
+typedef struct
+{
+	uint handle;
+	uint notify_source;
+	DBusMenuProxyNotify notify;
+	gpointer user_data;
+	DBusMenuProxyEntry *entry;
+} DBusMenuProxyClient;
+
+static GHashTable *pool_entries = NULL;
+static GHashTable *pool_clients = NULL;
+static uint pool_last_handle    = 0;
+
+static void dbus_menu_proxy_entry_notify(DBusMenuProxyEntry *entry)
+{
+	for (GSList *l = entry->clients; l != NULL; l = l->next)
+	{
+		DBusMenuProxyClient *client = (DBusMenuProxyClient *)l->data;
+		if (client->notify_source > 0)
+			g_source_remove(client->notify_source);
+		client->notify_source = 0;
+		client->notify(entry->proxy, client->user_data);
+	}
+}
+
+static bool dbus_menu_proxy_client_notify(DBusMenuProxyClient *client)
+{
+	client->notify_source = 0;
+	if (client->entry->proxy != NULL)
+		client->notify(client->entry->proxy, client->user_data);
+	return G_SOURCE_REMOVE;
+}
+
+static void dbus_menu_proxy_entry_free(DBusMenuProxyEntry *entry)
+{
+	if (entry->watch_id > 0)
+		g_bus_unwatch_name(entry->watch_id);
+	if (entry->expire_source > 0)
+		g_source_remove(entry->expire_source);
+	g_cancellable_cancel(entry->cancellable);
+	g_clear_object(&entry->cancellable);
+	g_clear_object(&entry->proxy);
+	g_free(entry->key);
+	g_free(entry->bus_name);
+	g_free(entry->object_path);
+	g_free(entry);
+}
+
+static void proxy_ready_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(GError) error = NULL;
+	DBusMenuXml *proxy      = dbus_menu_xml_proxy_new_finish(res, &error);
+
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return;
+	if (error)
+	{
+		g_warning("%s", error->message);
+		return;
+	}
+	DBusMenuProxyEntry *entry = (DBusMenuProxyEntry *)user_data;
+	g_clear_object(&entry->proxy);
+	entry->proxy = proxy;
+	dbus_menu_proxy_entry_notify(entry);
+}
+
+static void name_appeared_cb(GDBusConnection *connection, const char *name, const char *name_owner,
+                             gpointer user_data)
+{
+	DBusMenuProxyEntry *entry = (DBusMenuProxyEntry *)user_data;
+
+	/* Menu properties are never read, so GetAll and PropertiesChanged subscription are not
+	 * needed. Unique owner name keeps signal match rules bound to this owner only, and the
+	 * proxy does not watch the name again: the pool already does it.
+	 */
+	dbus_menu_xml_proxy_new(connection,
+	                        G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+	                            G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+	                        name_owner,
+	                        entry->object_path,
+	                        entry->cancellable,
+	                        proxy_ready_cb,
+	                        entry);
+}
+
+static void name_vanished_cb(GDBusConnection *connection, const char *name, gpointer user_data)
+{
+	DBusMenuProxyEntry *entry = (DBusMenuProxyEntry *)user_data;
+
+	// Proxy which is still in construction belongs to the old owner
+	g_cancellable_cancel(entry->cancellable);
+	g_clear_object(&entry->cancellable);
+	entry->cancellable = g_cancellable_new();
+	if (entry->proxy == NULL)
+		return;
+	g_clear_object(&entry->proxy);
+	dbus_menu_proxy_entry_notify(entry);
+}
+
+static bool dbus_menu_proxy_entry_expire(DBusMenuProxyEntry *entry)
+{
+	entry->expire_source = 0;
+	g_debug("Proxy for %s expired", entry->key);
+	g_hash_table_remove(pool_entries, entry->key);
+	return G_SOURCE_REMOVE;
+}
+
+G_GNUC_INTERNAL uint dbus_menu_proxy_pool_acquire(const char *bus_name, const char *object_path,
+                                                  DBusMenuProxyNotify notify,
+                                                  gpointer user_data)
+{
+	if (pool_entries == NULL)
+	{
+		pool_entries = g_hash_table_new_full(g_str_hash,
+		                                     g_str_equal,
+		                                     NULL,
+		                                     (GDestroyNotify)dbus_menu_proxy_entry_free);
+		pool_clients = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+	g_autofree char *key      = g_strdup_printf("%s%s", bus_name, object_path);
+	DBusMenuProxyEntry *entry = (DBusMenuProxyEntry *)g_hash_table_lookup(pool_entries, key);
+	if (entry == NULL)
+	{
+		entry              = g_new0(DBusMenuProxyEntry, 1);
+		entry->key         = g_steal_pointer(&key);
+		entry->bus_name    = g_strdup(bus_name);
+		entry->object_path = g_strdup(object_path);
+		entry->cancellable = g_cancellable_new();
+		g_hash_table_insert(pool_entries, entry->key, entry);
+		entry->watch_id = g_bus_watch_name(G_BUS_TYPE_SESSION,
+		                                   bus_name,
+		                                   G_BUS_NAME_WATCHER_FLAGS_NONE,
+		                                   name_appeared_cb,
+		                                   name_vanished_cb,
+		                                   entry,
+		                                   NULL);
+	}
+	else
+		g_debug("Proxy for %s is reused", entry->key);
+	if (entry->expire_source > 0)
+		g_source_remove(entry->expire_source);
+	entry->expire_source        = 0;
+	DBusMenuProxyClient *client = g_new0(DBusMenuProxyClient, 1);
+	client->handle              = ++pool_last_handle;
+	client->notify              = notify;
+	client->user_data           = user_data;
+	client->entry               = entry;
+	entry->clients              = g_slist_prepend(entry->clients, client);
+	g_hash_table_insert(pool_clients, GUINT_TO_POINTER(client->handle), client);
+	// Importers acquire proxies during construction and are listened to only after it, so a
+	// ready proxy is delivered from the main loop, like one which is still being built
+	if (entry->proxy != NULL)
+		client->notify_source =
+		    g_idle_add((GSourceFunc)dbus_menu_proxy_client_notify, client);
+	return client->handle;
+}
+
+G_GNUC_INTERNAL void dbus_menu_proxy_pool_release(uint handle)
+{
+	if (pool_clients == NULL)
+		return;
+	DBusMenuProxyClient *client =
+	    (DBusMenuProxyClient *)g_hash_table_lookup(pool_clients, GUINT_TO_POINTER(handle));
+	if (client == NULL)
+		return;
+	g_hash_table_remove(pool_clients, GUINT_TO_POINTER(handle));
+	DBusMenuProxyEntry *entry = client->entry;
+	entry->clients            = g_slist_remove(entry->clients, client);
+	if (client->notify_source > 0)
+		g_source_remove(client->notify_source);
+	g_free(client);
+	if (entry->clients == NULL && entry->expire_source == 0)
+		entry->expire_source =
+		    g_timeout_add_seconds(PROXY_POOL_EXPIRE_SECONDS,
+		                          (GSourceFunc)dbus_menu_proxy_entry_expire,
+		                          entry);
+}
@@ -0,0 +1,37 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "dbusmenu-interface.h"
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+// Called with the proxy when the menu owner appears, and with NULL when it vanishes
+typedef void (*DBusMenuProxyNotify)(DBusMenuXml *proxy, gpointer user_data);
+
+G_GNUC_INTERNAL uint dbus_menu_proxy_pool_acquire(const char *bus_name, const char *object_path,
+                                                  DBusMenuProxyNotify notify,
+                                                  gpointer user_data);
+G_GNUC_INTERNAL void dbus_menu_proxy_pool_release(uint handle);
+
+G_END_DECLS
+
+#endif // POOL_H
@@ -38,59 +38,54 @@ static int dbus_menu_section_model_is_mutable(GMenuModel *model)
 static gint dbus_menu_section_model_get_n_items(GMenuModel *model)
 {
 	DBusMenuSectionModel *menu = DBUS_MENU_SECTION_MODEL(model);
-	GSequence *items           = dbus_menu_model_items(menu->parent_model);
-	int begin = 0, end = -1;
-	for (GSequenceIter *iter = g_sequence_get_begin_iter(items); !g_sequence_iter_is_end(iter);
-	     iter                = g_sequence_iter_next(iter))
-	{
-		DBusMenuItem *item = (DBusMenuItem *)g_sequence_get(iter);
-		if (item->section_num == menu->section_index && item->place == -1)
-			begin = g_sequence_iter_get_position(iter);
-		end = g_sequence_iter_get_position(iter);
-		if (item->section_num == menu->section_index + 1 && item->place == -1)
-		{
-			end--;
-			break;
-		}
-	}
-	return end - begin;
+	return dbus_menu_model_get_section_n_items(menu->parent_model, menu->section_index);
 }
 
 static void dbus_menu_section_model_get_item_attributes(GMenuModel *model, gint position,
                                                         GHashTable **table)
 {
 	DBusMenuSectionModel *menu = DBUS_MENU_SECTION_MODEL(model);
-	GSequence *items           = dbus_menu_model_items(menu->parent_model);
-	for (GSequenceIter *iter = g_sequence_get_begin_iter(items); !g_sequence_iter_is_end(iter);
-	     iter                = g_sequence_iter_next(iter))
-	{
-		DBusMenuItem *item = (DBusMenuItem *)g_sequence_get(iter);
-		if (item->section_num == menu->section_index && item->place == position)
-		{
-			*table = g_hash_table_ref(item->attrs);
-			return;
-		}
-	}
+	DBusMenuItem *item =
+	    dbus_menu_model_get_section_item(menu->parent_model, menu->section_index, position);
+	if (item != NULL)
+		*table = dbus_menu_item_get_attributes(item);
+}
+
+static GVariant *dbus_menu_section_model_get_item_attribute_value(GMenuModel *model, gint position,
+                                                                  const gchar *attribute,
+                                                                  const GVariantType *expected_type)
+{
+	DBusMenuSectionModel *menu = DBUS_MENU_SECTION_MODEL(model);
+	DBusMenuItem *item =
+	    dbus_menu_model_get_section_item(menu->parent_model, menu->section_index, position);
+	if (item == NULL)
+		return NULL;
+	return dbus_menu_item_get_attribute_value(item, attribute, expected_type);
 }
 
 static void dbus_menu_section_model_get_item_links(GMenuModel *model, gint position,
                                                    GHashTable **table)
 {
 	DBusMenuSectionModel *menu = DBUS_MENU_SECTION_MODEL(model);
-	GSequence *items           = dbus_menu_model_items(menu->parent_model);
-	for (GSequenceIter *iter = g_sequence_get_begin_iter(items); !g_sequence_iter_is_end(iter);
-	     iter                = g_sequence_iter_next(iter))
+	DBusMenuItem *item =
+	    dbus_menu_model_get_section_item(menu->parent_model, menu->section_index, position);
+	if (item != NULL)
 	{
-		DBusMenuItem *item = (DBusMenuItem *)g_sequence_get(iter);
-		if (item->section_num == menu->section_index && item->place == position)
-		{
-			if (g_hash_table_contains(item->links, G_MENU_LINK_SECTION))
-				g_warning("Item has section, but should not\n");
-			*table = g_hash_table_ref(item->links);
-			return;
-		}
+		if (dbus_menu_item_get_link(item, G_MENU_LINK_SECTION) != NULL)
+			g_warning("Item has section, but should not\n");
+		*table = dbus_menu_item_get_links(item);
 	}
 }
+
+static GMenuModel *dbus_menu_section_model_get_item_link(GMenuModel *model, gint position,
+                                                         const gchar *link)
+{
+	DBusMenuSectionModel *menu = DBUS_MENU_SECTION_MODEL(model);
+	DBusMenuItem *item =
+	    dbus_menu_model_get_section_item(menu->parent_model, menu->section_index, position);
+	GMenuModel *ret = item != NULL ? dbus_menu_item_get_link(item, link) : NULL;
+	return ret != NULL ? g_object_ref(ret) : NULL;
+}
 static void dbus_menu_section_model_init(DBusMenuSectionModel *menu)
 {
 	menu->parent_model = NULL;
@@ -177,10 +172,12 @@ static void dbus_menu_section_model_class_init(DBusMenuSectionModelClass *klass)
 	object_class->get_property = dbus_menu_section_model_get_property;
 	object_class->constructed  = dbus_menu_section_model_constructed;
 
-	model_class->is_mutable          = dbus_menu_section_model_is_mutable;
-	model_class->get_n_items         = dbus_menu_section_model_get_n_items;
-	model_class->get_item_attributes = dbus_menu_section_model_get_item_attributes;
-	model_class->get_item_links      = dbus_menu_section_model_get_item_links;
+	model_class->is_mutable               = dbus_menu_section_model_is_mutable;
+	model_class->get_n_items              = dbus_menu_section_model_get_n_items;
+	model_class->get_item_attributes      = dbus_menu_section_model_get_item_attributes;
+	model_class->get_item_links           = dbus_menu_section_model_get_item_links;
+	model_class->get_item_attribute_value = dbus_menu_section_model_get_item_attribute_value;
+	model_class->get_item_link            = dbus_menu_section_model_get_item_link;
 	install_properties(object_class);
 }
 
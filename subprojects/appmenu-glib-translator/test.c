@@ -20,6 +20,40 @@
 #include "importer.h"
 #include <gtk/gtk.h>
 #include <stdbool.h>
+#include <sys/resource.h>
+
+/* Usage: test [--headless] [--prefetch] [--quiet-time=MS] BUS_NAME OBJECT_PATH
+ * Without --headless the menu is shown in a window. With --headless no display is needed:
+ * the menu is loaded until it stays unchanged for quiet time, and then timings and
+ * counters are printed.
+ */
+static bool headless  = false;
+static bool prefetch  = false;
+static int quiet_time = 1000;
+
+static GOptionEntry entries[] = {
+	{ "headless", 0, 0, G_OPTION_ARG_NONE, &headless, "Measure without showing a window", NULL },
+	{ "prefetch", 0, 0, G_OPTION_ARG_NONE, &prefetch, "Fetch whole menu tree at once", NULL },
+	{ "quiet-time",
+	  0,
+	  0,
+	  G_OPTION_ARG_INT,
+	  &quiet_time,
+	  "Time without changes to finish, in milliseconds",
+	  "MS" },
+	{ NULL }
+};
+
+typedef struct
+{
+	GMainLoop *loop;
+	gint64 start;
+	gint64 first_model;
+	gint64 last_change;
+	uint changes;
+	uint quiet_source;
+	GHashTable *models;
+} Measure;
 
 void on_importer_model_changed(GObject *obj, GParamSpec *pspec, gpointer data)
 {
@@ -42,8 +76,132 @@ void on_importer_model_changed(GObject *obj, GParamSpec *pspec, gpointer data)
 	}
 }
 
+static uint count_items(GMenuModel *model, uint depth, uint *max_depth)
+{
+	uint ret   = 0;
+	*max_depth = MAX(*max_depth, depth);
+	for (int i = 0; i < g_menu_model_get_n_items(model); i++)
+	{
+		g_autoptr(GMenuModel) section =
+		    g_menu_model_get_item_link(model, i, G_MENU_LINK_SECTION);
+		g_autoptr(GMenuModel) submenu =
+		    g_menu_model_get_item_link(model, i, G_MENU_LINK_SUBMENU);
+		if (section != NULL)
+			ret += count_items(section, depth, max_depth);
+		else
+			ret++;
+		if (submenu != NULL)
+			ret += count_items(submenu, depth + 1, max_depth);
+	}
+	return ret;
+}
+
+static bool on_quiet(Measure *measure)
+{
+	measure->quiet_source = 0;
+	g_main_loop_quit(measure->loop);
+	return G_SOURCE_REMOVE;
+}
+
+static void on_items_changed(GMenuModel *model, gint position, gint removed, gint added,
+                             Measure *measure);
+
+// Root reports only changes of its section count, items are reported by sections and submenus
+static void watch_model(Measure *measure, GMenuModel *model, int position, int n_items)
+{
+	if (!g_hash_table_contains(measure->models, model))
+	{
+		g_hash_table_add(measure->models, g_object_ref(model));
+		g_signal_connect(model, "items-changed", G_CALLBACK(on_items_changed), measure);
+	}
+	for (int i = position; i < position + n_items; i++)
+	{
+		g_autoptr(GMenuModel) section =
+		    g_menu_model_get_item_link(model, i, G_MENU_LINK_SECTION);
+		g_autoptr(GMenuModel) submenu =
+		    g_menu_model_get_item_link(model, i, G_MENU_LINK_SUBMENU);
+		if (section != NULL)
+			watch_model(measure, section, 0, g_menu_model_get_n_items(section));
+		if (submenu != NULL)
+			watch_model(measure, submenu, 0, g_menu_model_get_n_items(submenu));
+	}
+}
+
+static void on_items_changed(GMenuModel *model, gint position, gint removed, gint added,
+                             Measure *measure)
+{
+	measure->changes++;
+	measure->last_change = g_get_monotonic_time();
+	if (measure->first_model == 0 && g_menu_model_get_n_items(model) > 0)
+		measure->first_model = measure->last_change;
+	watch_model(measure, model, position, added);
+	if (measure->quiet_source > 0)
+		g_source_remove(measure->quiet_source);
+	measure->quiet_source = g_timeout_add(quiet_time, (GSourceFunc)on_quiet, measure);
+}
+
+static int run_headless(DBusMenuImporter *importer)
+{
+	Measure measure = { 0 };
+	GMenuModel *model;
+	measure.loop  = g_main_loop_new(NULL, false);
+	measure.start  = g_get_monotonic_time();
+	measure.models = g_hash_table_new_full(NULL, NULL, g_object_unref, NULL);
+	g_object_get(importer, "model", &model, NULL);
+	watch_model(&measure, model, 0, g_menu_model_get_n_items(model));
+	measure.quiet_source = g_timeout_add(quiet_time * 10, (GSourceFunc)on_quiet, &measure);
+	g_main_loop_run(measure.loop);
+
+	uint max_depth = 0;
+	uint items     = count_items(model, 0, &max_depth);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	if (measure.first_model == 0)
+		g_print("no menu received\n");
+	else
+		g_print("first model: %.1f ms\n", (measure.first_model - measure.start) / 1000.0);
+	g_print("last change: %.1f ms\n", (measure.last_change - measure.start) / 1000.0);
+	g_print("items-changed: %u in %u models\n",
+	        measure.changes,
+	        g_hash_table_size(measure.models));
+	g_print("items: %u, depth: %u\n", items, max_depth);
+	g_print("peak RSS: %ld KiB\n", usage.ru_maxrss);
+	GHashTableIter iter;
+	gpointer watched;
+	g_hash_table_iter_init(&iter, measure.models);
+	while (g_hash_table_iter_next(&iter, &watched, NULL))
+		g_signal_handlers_disconnect_by_data(watched, &measure);
+	g_hash_table_unref(measure.models);
+	g_object_unref(model);
+	g_main_loop_unref(measure.loop);
+	return measure.first_model == 0 ? 1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
+	g_autoptr(GError) error           = NULL;
+	g_autoptr(GOptionContext) context = g_option_context_new("BUS_NAME OBJECT_PATH");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error) || argc != 3)
+	{
+		g_printerr("%s\n",
+		           error != NULL ? error->message : "Bus name and object path are required");
+		return 2;
+	}
+	if (headless)
+	{
+		DBusMenuImporter *importer = g_object_new(dbus_menu_importer_get_type(),
+		                                          "bus-name",
+		                                          argv[1],
+		                                          "object-path",
+		                                          argv[2],
+		                                          "prefetch",
+		                                          prefetch,
+		                                          NULL);
+		int ret = run_headless(importer);
+		g_object_unref(importer);
+		return ret;
+	}
 	gtk_init(&argc, &argv);
 
 	GtkWindow *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -54,17 +212,16 @@ int main(int argc, char *argv[])
 	GtkBox *vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
 	gtk_container_add(GTK_CONTAINER(window), vbox);
 
-	GtkMenuBar *menubar = gtk_menu_bar_new();
-	GtkMenuButton *menu = gtk_menu_button_new();
-	//	DBusMenuImporter *importer = dbus_menu_importer_new("org.krusader", "/MenuBar/2");
-	DBusMenuImporter *importer = dbus_menu_importer_new(":1.250", "/MenuBar/1");
-	//	DBusMenuImporter *importer = dbus_menu_importer_new(":1.49", "/MenuBar/2");
-	//	DBusMenuImporter *importer =
-	//	    dbus_menu_importer_new(":1.227", "/com/canonical/menu/300003e");
-	//	DBusMenuImporter *importer =
-	//	    dbus_menu_importer_new(":1.458", "/com/canonical/menu/4600016");
-	//	DBusMenuImporter *importer =
-	//	    dbus_menu_importer_new(":1.542", "/com/canonical/menu/2600041");
+	GtkMenuBar *menubar        = gtk_menu_bar_new();
+	GtkMenuButton *menu        = gtk_menu_button_new();
+	DBusMenuImporter *importer = g_object_new(dbus_menu_importer_get_type(),
+	                                          "bus-name",
+	                                          argv[1],
+	                                          "object-path",
+	                                          argv[2],
+	                                          "prefetch",
+	                                          prefetch,
+	                                          NULL);
 	g_signal_connect(importer, "notify::model", G_CALLBACK(on_importer_model_changed), menubar);
 	g_signal_connect(importer, "notify::model", G_CALLBACK(on_importer_model_changed), menu);
 	g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
@@ -0,0 +1,139 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Lookup cost on a 2,000-item menu. Items are found by id when properties change and by
+ * (section, place) when GTK reads a section. Both go through indexes of the model and are
+ * compared with a linear scan over the same items in model order, which is what lookups cost
+ * before the model had indexes. Then the layout shrinks and grows back to check that indexes
+ * never keep items the parse has freed.
+ */
+
+#include "actions.h"
+#include "common.h"
+#include "item.h"
+#include "model.h"
+
+#define N_ITEMS 2000
+#define SECTION_SIZE 20
+#define ROUNDS 50
+
+static DBusMenuItem *linear_find(GPtrArray *items, uint id)
+{
+	for (uint i = 0; i < items->len; i++)
+	{
+		DBusMenuItem *item = g_ptr_array_index(items, i);
+		if (item->id == id)
+			return item;
+	}
+	return NULL;
+}
+
+static DBusMenuItem *linear_find_place(GPtrArray *items, int section_num, int place)
+{
+	for (uint i = 0; i < items->len; i++)
+	{
+		DBusMenuItem *item = g_ptr_array_index(items, i);
+		if (item->section_num == section_num && item->place == place)
+			return item;
+	}
+	return NULL;
+}
+
+static void apply_flat(DBusMenuModel *menu, uint n_items, uint revision)
+{
+	g_autoptr(GVariant) layout =
+	    g_variant_ref_sink(test_layout_flat(n_items, SECTION_SIZE, revision));
+	dbus_menu_model_apply_layout(menu, layout);
+}
+
+static GPtrArray *collect_items(DBusMenuModel *menu, uint n_sections)
+{
+	GPtrArray *items = g_ptr_array_new();
+	for (uint s = 0; s < n_sections; s++)
+	{
+		g_ptr_array_add(items, dbus_menu_model_get_section_item(menu, s, -1));
+		uint n = dbus_menu_model_get_section_n_items(menu, s);
+		for (uint p = 0; p < n; p++)
+			g_ptr_array_add(items, dbus_menu_model_get_section_item(menu, s, p));
+	}
+	return items;
+}
+
+int main(int argc, char **argv)
+{
+	g_autoptr(DBusMenuActionGroup) actions = dbus_menu_action_group_new();
+	g_autoptr(DBusMenuModel) menu =
+	    dbus_menu_model_new(0, NULL, NULL, G_ACTION_GROUP(actions));
+	uint n_sections = N_ITEMS / SECTION_SIZE;
+
+	gint64 start = g_get_monotonic_time();
+	apply_flat(menu, N_ITEMS, 0);
+	g_print("parse of %d items: %.3f ms\n", N_ITEMS, test_elapsed_ms(start));
+	g_assert_cmpint(g_menu_model_get_n_items(G_MENU_MODEL(menu)), ==, n_sections);
+	g_autoptr(GPtrArray) items = collect_items(menu, n_sections);
+	g_assert_cmpuint(items->len, ==, N_ITEMS + n_sections);
+
+	start = g_get_monotonic_time();
+	for (uint r = 0; r < ROUNDS; r++)
+		for (uint id = 1; id <= N_ITEMS; id++)
+			g_assert_cmpuint(dbus_menu_model_get_item(menu, id)->id, ==, id);
+	double indexed_ids = test_elapsed_ms(start);
+
+	start = g_get_monotonic_time();
+	for (uint r = 0; r < ROUNDS; r++)
+		for (uint id = 1; id <= N_ITEMS; id++)
+			g_assert_cmpuint(linear_find(items, id)->id, ==, id);
+	double linear_ids = test_elapsed_ms(start);
+
+	start = g_get_monotonic_time();
+	for (uint r = 0; r < ROUNDS; r++)
+		for (uint s = 0; s < n_sections; s++)
+			for (int p = 0; p < SECTION_SIZE; p++)
+				g_assert_nonnull(dbus_menu_model_get_section_item(menu, s, p));
+	double indexed_places = test_elapsed_ms(start);
+
+	start = g_get_monotonic_time();
+	for (uint r = 0; r < ROUNDS; r++)
+		for (uint s = 0; s < n_sections; s++)
+			for (int p = 0; p < SECTION_SIZE; p++)
+				g_assert_nonnull(linear_find_place(items, s, p));
+	double linear_places = test_elapsed_ms(start);
+
+	uint lookups = ROUNDS * N_ITEMS;
+	g_print("%u lookups by id: indexed %.3f ms, linear %.3f ms\n",
+	        lookups,
+	        indexed_ids,
+	        linear_ids);
+	g_print("%u lookups by place: indexed %.3f ms, linear %.3f ms\n",
+	        lookups,
+	        indexed_places,
+	        linear_places);
+
+	// Dropped items must leave indexes with the parse that freed them
+	apply_flat(menu, N_ITEMS / 2, 1);
+	g_assert_null(dbus_menu_model_get_item(menu, N_ITEMS));
+	g_assert_null(dbus_menu_model_get_item(menu, TEST_SEPARATOR_ID + N_ITEMS - SECTION_SIZE));
+	g_assert_cmpuint(dbus_menu_model_get_section_n_items(menu, n_sections - 1), ==, 0);
+	g_assert_cmpuint(dbus_menu_model_get_item(menu, N_ITEMS / 2)->id, ==, N_ITEMS / 2);
+	apply_flat(menu, N_ITEMS, 2);
+	g_assert_cmpuint(dbus_menu_model_get_item(menu, N_ITEMS)->id, ==, N_ITEMS);
+	g_assert_cmpuint(dbus_menu_model_get_section_n_items(menu, n_sections - 1),
+	                 ==,
+	                 SECTION_SIZE);
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Heap used by items of a large menu. Attributes are kept in fixed slots, and GTK gets hash
+ * tables only when it asks for them. The baseline is what the same items cost before: one
+ * attribute and one link table per item with duplicated keys, which are built here for every
+ * item and measured on top of the model.
+ */
+
+#include "actions.h"
+#include "common.h"
+#include "item.h"
+#include "model.h"
+
+#define N_ITEMS 5000
+#define SECTION_SIZE 25
+
+static GHashTable *copy_table(GHashTable *table, GBoxedCopyFunc value_ref,
+                              GDestroyNotify value_free)
+{
+	GHashTable *copy = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, value_free);
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, table);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_hash_table_insert(copy, g_strdup(key), value_ref(value));
+	return copy;
+}
+
+int main(int argc, char **argv)
+{
+	if (test_heap_bytes() < 0)
+	{
+		g_print("heap statistics are not available\n");
+		return 77;
+	}
+	g_autoptr(GVariant) layout =
+	    g_variant_ref_sink(test_layout_flat(N_ITEMS, SECTION_SIZE, 0));
+	g_autoptr(DBusMenuActionGroup) actions = dbus_menu_action_group_new();
+
+	gint64 heap_start = test_heap_bytes();
+	g_autoptr(DBusMenuModel) menu =
+	    dbus_menu_model_new(0, NULL, NULL, G_ACTION_GROUP(actions));
+	dbus_menu_model_apply_layout(menu, layout);
+	gint64 model_heap = test_heap_bytes() - heap_start;
+
+	heap_start = test_heap_bytes();
+	g_autoptr(GPtrArray) tables =
+	    g_ptr_array_new_with_free_func((GDestroyNotify)g_hash_table_unref);
+	for (uint id = 1; id <= N_ITEMS; id++)
+	{
+		DBusMenuItem *item          = dbus_menu_model_get_item(menu, id);
+		g_autoptr(GHashTable) attrs = dbus_menu_item_get_attributes(item);
+		g_autoptr(GHashTable) links = dbus_menu_item_get_links(item);
+		g_ptr_array_add(tables,
+		                copy_table(attrs,
+		                           (GBoxedCopyFunc)g_variant_ref,
+		                           (GDestroyNotify)g_variant_unref));
+		g_ptr_array_add(tables, copy_table(links, g_object_ref, g_object_unref));
+	}
+	gint64 tables_heap = test_heap_bytes() - heap_start;
+
+	double slots = sizeof(((DBusMenuItem *)NULL)->attrs) + sizeof(const char *) +
+	               sizeof(GMenuModel *);
+	g_print("%d items: model with actions %.0f bytes/item, attribute slots %.0f bytes/item\n",
+	        N_ITEMS,
+	        (double)model_heap / N_ITEMS,
+	        slots);
+	g_print("two hash tables per item: %.0f bytes/item\n", (double)tables_heap / N_ITEMS);
+	g_print("peak RSS %" G_GINT64_FORMAT " KiB\n", test_peak_rss_kb());
+	g_assert_cmpfloat((double)tables_heap / N_ITEMS, >, slots);
+	return 0;
+}
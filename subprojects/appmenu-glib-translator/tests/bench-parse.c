@@ -0,0 +1,67 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Layout parse throughput over a menubar layout stored in text form. Fresh models build
+ * every item from its properties; a kept model gets two revisions of the layout in turn,
+ * which differ in a property of every item, so every item is updated in place.
+ */
+
+#include "actions.h"
+#include "common.h"
+#include "model.h"
+
+#define ROUNDS 200
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		g_printerr("Usage: %s LAYOUT\n", argv[0]);
+		return 1;
+	}
+	g_autoptr(GVariant) layout  = test_layout_load(argv[1], NULL, NULL);
+	g_autoptr(GVariant) revised =
+	    test_layout_load(argv[1], "'enabled': <true>", "'enabled': <false>");
+	g_autoptr(DBusMenuActionGroup) actions = dbus_menu_action_group_new();
+	uint n_items = test_layout_count(layout);
+
+	gint64 start = g_get_monotonic_time();
+	for (uint i = 0; i < ROUNDS; i++)
+	{
+		g_autoptr(DBusMenuModel) menu =
+		    dbus_menu_model_new(0, NULL, NULL, G_ACTION_GROUP(actions));
+		dbus_menu_model_apply_layout(menu, layout);
+	}
+	double fresh_ms = test_elapsed_ms(start);
+
+	g_autoptr(DBusMenuModel) menu =
+	    dbus_menu_model_new(0, NULL, NULL, G_ACTION_GROUP(actions));
+	start = g_get_monotonic_time();
+	for (uint i = 0; i < ROUNDS; i++)
+		dbus_menu_model_apply_layout(menu, i % 2 ? revised : layout);
+	double update_ms = test_elapsed_ms(start);
+
+	g_print("%u items, %d rounds\n", n_items, ROUNDS);
+	g_print("fresh model: %.3f ms per layout, %.0f items/s\n",
+	        fresh_ms / ROUNDS,
+	        n_items * ROUNDS / fresh_ms * 1000);
+	g_print("update in place: %.3f ms per layout, %.0f items/s\n",
+	        update_ms / ROUNDS,
+	        n_items * ROUNDS / update_ms * 1000);
+	return 0;
+}
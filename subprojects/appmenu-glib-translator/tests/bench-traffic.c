@@ -0,0 +1,154 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Signal traffic of many menu owners. Every fake application sends a burst of property
+ * updates, while the panel shows the menu of one of them. Menu proxies subscribe only to
+ * their owner and path, so the panel connection should receive the signals of that owner
+ * alone. A connection subscribed to the whole com.canonical.dbusmenu interface, as proxies
+ * with broad match rules were, is the baseline.
+ */
+
+#include "common.h"
+#include "fake-server.h"
+#include "importer.h"
+
+#define MENU_PATH "/MenuBar"
+#define DBUSMENU_INTERFACE "com.canonical.dbusmenu"
+#define N_APPS 20
+#define SIGNALS_PER_APP 100
+#define SETTLE_MS 300
+#define DEADLINE_MS 10000
+
+static int panel_signals = 0;
+
+// Runs in the GDBus worker thread
+static GDBusMessage *count_signal(GDBusConnection *connection, GDBusMessage *message,
+                                  gboolean incoming, gpointer user_data)
+{
+	if (incoming && g_dbus_message_get_message_type(message) == G_DBUS_MESSAGE_TYPE_SIGNAL &&
+	    g_strcmp0(g_dbus_message_get_interface(message), DBUSMENU_INTERFACE) == 0)
+		g_atomic_int_inc(&panel_signals);
+	return message;
+}
+
+static void count_broad_signal(GDBusConnection *connection, const char *sender_name,
+                               const char *object_path, const char *interface_name,
+                               const char *signal_name, GVariant *parameters, uint *signals)
+{
+	(*signals)++;
+}
+
+static void count_notify(GObject *object, GParamSpec *pspec, uint *notifies)
+{
+	(*notifies)++;
+}
+
+// Iterates the main context until *value reaches target or the deadline passes
+static void run_until(uint *value, uint target, gint64 start, gint64 deadline_ms)
+{
+	while (*value < target && test_elapsed_ms(start) < deadline_ms)
+	{
+		g_main_context_iteration(NULL, false);
+		g_usleep(1000);
+	}
+}
+
+static void bench_traffic(void)
+{
+	g_autoptr(GError) error = NULL;
+	FakeServer *servers[N_APPS];
+	for (uint i = 0; i < N_APPS; i++)
+		servers[i] = fake_server_new(MENU_PATH, test_layout_flat(10, 0, 0));
+	g_autoptr(GDBusConnection) panel = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+	g_assert_no_error(error);
+	uint filter = g_dbus_connection_add_filter(panel, count_signal, NULL, NULL);
+	uint notifies              = 0;
+	DBusMenuImporter *importer = dbus_menu_importer_new(fake_server_get_name(servers[0]),
+	                                                    MENU_PATH);
+	g_signal_connect(importer, "notify::model", G_CALLBACK(count_notify), &notifies);
+	run_until(&notifies, 1, g_get_monotonic_time(), DEADLINE_MS);
+	g_assert_cmpuint(notifies, >, 0);
+
+	g_autoptr(GDBusConnection) broad = test_bus_connection_new();
+	uint broad_signals               = 0;
+	uint subscription =
+	    g_dbus_connection_signal_subscribe(broad,
+	                                       NULL,
+	                                       DBUSMENU_INTERFACE,
+	                                       NULL,
+	                                       NULL,
+	                                       NULL,
+	                                       G_DBUS_SIGNAL_FLAGS_NONE,
+	                                       (GDBusSignalCallback)count_broad_signal,
+	                                       &broad_signals,
+	                                       NULL);
+	// Match rules are set up asynchronously, a round trip makes sure they are in place
+	g_dbus_connection_flush_sync(broad, NULL, NULL);
+	g_dbus_connection_call_sync(broad,
+	                            "org.freedesktop.DBus",
+	                            "/org/freedesktop/DBus",
+	                            "org.freedesktop.DBus",
+	                            "GetId",
+	                            NULL,
+	                            NULL,
+	                            G_DBUS_CALL_FLAGS_NONE,
+	                            -1,
+	                            NULL,
+	                            NULL);
+
+	g_atomic_int_set(&panel_signals, 0);
+	gint64 start = g_get_monotonic_time();
+	for (uint i = 0; i < N_APPS; i++)
+		for (uint j = 0; j < SIGNALS_PER_APP; j++)
+		{
+			g_autofree char *label = g_strdup_printf("Item %u", j);
+			fake_server_emit_label(servers[i], 1, label);
+		}
+	run_until(&broad_signals, N_APPS * SIGNALS_PER_APP, start, DEADLINE_MS);
+	double elapsed = test_elapsed_ms(start);
+	// Signals for the panel could still be on their way
+	run_until(&(uint){ 0 }, 1, g_get_monotonic_time(), SETTLE_MS);
+
+	uint received = (uint)g_atomic_int_get(&panel_signals);
+	g_print("%d applications, %d signals each, delivered in %.1f ms\n",
+	        N_APPS,
+	        SIGNALS_PER_APP,
+	        elapsed);
+	g_print("panel connection: %u signals\n", received);
+	g_print("interface-wide subscription: %u signals\n", broad_signals);
+	g_assert_cmpuint(broad_signals, ==, N_APPS * SIGNALS_PER_APP);
+	g_assert_cmpuint(received, <=, SIGNALS_PER_APP);
+
+	g_dbus_connection_signal_unsubscribe(broad, subscription);
+	g_dbus_connection_remove_filter(panel, filter);
+	g_object_unref(importer);
+	for (uint i = 0; i < N_APPS; i++)
+		fake_server_free(servers[i]);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_autoptr(GTestDBus) bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(bus);
+	g_test_add_func("/traffic/many-applications", bench_traffic);
+	int ret = g_test_run();
+	// Pooled proxies outlive importers for a while, and they hold the session connection
+	g_test_dbus_stop(bus);
+	return ret;
+}
@@ -0,0 +1,125 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Layout walk cost on large layouts. The unpacking walk reads every node with
+ * g_variant_get("(i@a{sv}@av)") and every child with g_variant_iter_next_value, as
+ * layout_parse did before; the indexed walk takes children by index, as it does now. Both
+ * run on layouts in tree form, as GDBus builds them, and in serialized form. A full apply
+ * of each layout to a fresh model is measured too.
+ */
+
+#include "actions.h"
+#include "common.h"
+#include "model.h"
+
+#define ROUNDS 20
+
+static gint64 walk_unpacked(GVariant *node)
+{
+	int id;
+	g_autoptr(GVariant) props    = NULL;
+	g_autoptr(GVariant) children = NULL;
+	g_variant_get(node, "(i@a{sv}@av)", &id, &props, &children);
+	gint64 sum = id + (gint64)g_variant_n_children(props);
+	GVariantIter iter;
+	g_variant_iter_init(&iter, children);
+	GVariant *child;
+	while ((child = g_variant_iter_next_value(&iter)) != NULL)
+	{
+		g_autoptr(GVariant) value = g_variant_get_variant(child);
+		sum += walk_unpacked(value);
+		g_variant_unref(child);
+	}
+	return sum;
+}
+
+static gint64 walk_indexed(GVariant *node)
+{
+	g_autoptr(GVariant) idv      = g_variant_get_child_value(node, 0);
+	g_autoptr(GVariant) props    = g_variant_get_child_value(node, 1);
+	g_autoptr(GVariant) children = g_variant_get_child_value(node, 2);
+	gint64 sum = g_variant_get_int32(idv) + (gint64)g_variant_n_children(props);
+	for (gsize i = 0; i < g_variant_n_children(children); i++)
+	{
+		g_autoptr(GVariant) child = g_variant_get_child_value(children, i);
+		g_autoptr(GVariant) value = g_variant_get_variant(child);
+		sum += walk_indexed(value);
+	}
+	return sum;
+}
+
+static double time_walk(gint64 (*walk)(GVariant *), GVariant *layout, gint64 *sum)
+{
+	gint64 start = g_get_monotonic_time();
+	for (uint i = 0; i < ROUNDS; i++)
+		*sum = walk(layout);
+	return test_elapsed_ms(start) / ROUNDS;
+}
+
+static double time_apply(GVariant *layout)
+{
+	g_autoptr(DBusMenuActionGroup) actions = dbus_menu_action_group_new();
+	gint64 start                           = g_get_monotonic_time();
+	for (uint i = 0; i < ROUNDS; i++)
+	{
+		g_autoptr(DBusMenuModel) menu =
+		    dbus_menu_model_new(0, NULL, NULL, G_ACTION_GROUP(actions));
+		dbus_menu_model_set_prefetch(menu, true);
+		dbus_menu_model_apply_layout(menu, layout);
+	}
+	return test_elapsed_ms(start) / ROUNDS;
+}
+
+static void bench_layout(const char *name, GVariant *layout)
+{
+	gint64 unpacked_sum = 0, indexed_sum = 0;
+	double unpacked = time_walk(walk_unpacked, layout, &unpacked_sum);
+	double indexed  = time_walk(walk_indexed, layout, &indexed_sum);
+	g_assert_cmpint(unpacked_sum, ==, indexed_sum);
+	g_print("%-22s %8u items: unpacked %8.3f ms, indexed %8.3f ms, apply %8.3f ms\n",
+	        name,
+	        test_layout_count(layout),
+	        unpacked,
+	        indexed,
+	        time_apply(layout));
+}
+
+int main(int argc, char **argv)
+{
+	struct
+	{
+		const char *name;
+		GVariant *layout;
+	} layouts[] = {
+		{ "flat 5000", test_layout_flat(5000, 20, 0) },
+		{ "flat 20000", test_layout_flat(20000, 20, 0) },
+		{ "nested 200x50", test_layout_nested(200, 50) },
+	};
+	g_print("%d rounds, time per layout\n", ROUNDS);
+	for (uint i = 0; i < G_N_ELEMENTS(layouts); i++)
+	{
+		g_autoptr(GVariant) tree       = g_variant_ref_sink(layouts[i].layout);
+		g_autoptr(GBytes) bytes        = g_variant_get_data_as_bytes(tree);
+		g_autoptr(GVariant) serialized = g_variant_ref_sink(
+		    g_variant_new_from_bytes(g_variant_get_type(tree), bytes, true));
+		g_autofree char *name = g_strdup_printf("%s, serialized", layouts[i].name);
+		bench_layout(layouts[i].name, tree);
+		bench_layout(name, serialized);
+	}
+	return 0;
+}
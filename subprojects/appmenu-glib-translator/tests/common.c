@@ -0,0 +1,223 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "common.h"
+
+// Builds a (ia{sv}av) node. Takes ownership of floating children, which has type av.
+GVariant *test_layout_item(int id, const char *label, GVariant *children)
+{
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&props, "{sv}", "label", g_variant_new_string(label));
+	g_variant_builder_add(&props, "{sv}", "enabled", g_variant_new_boolean(true));
+	if (children != NULL)
+		g_variant_builder_add(&props,
+		                      "{sv}",
+		                      "children-display",
+		                      g_variant_new_string("submenu"));
+	else
+		children = g_variant_new_array(G_VARIANT_TYPE_VARIANT, NULL, 0);
+	return g_variant_new("(i@a{sv}@av)", id, g_variant_builder_end(&props), children);
+}
+
+GVariant *test_layout_separator(int id)
+{
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&props, "{sv}", "type", g_variant_new_string("separator"));
+	return g_variant_new("(i@a{sv}@av)",
+	                     id,
+	                     g_variant_builder_end(&props),
+	                     g_variant_new_array(G_VARIANT_TYPE_VARIANT, NULL, 0));
+}
+
+/* Root layout of n_items items with ids 1..n_items, split by a separator every section_size
+ * items. Labels carry revision, so two revisions differ in every label but not in structure.
+ */
+GVariant *test_layout_flat(uint n_items, uint section_size, uint revision)
+{
+	GVariantBuilder children;
+	g_variant_builder_init(&children, G_VARIANT_TYPE("av"));
+	for (uint i = 0; i < n_items; i++)
+	{
+		if (i > 0 && section_size > 0 && i % section_size == 0)
+			g_variant_builder_add(&children,
+			                      "v",
+			                      test_layout_separator(TEST_SEPARATOR_ID + i));
+		g_autofree char *label = g_strdup_printf("Item %u.%u", i + 1, revision);
+		g_variant_builder_add(&children, "v", test_layout_item(i + 1, label, NULL));
+	}
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&props,
+	                      "{sv}",
+	                      "children-display",
+	                      g_variant_new_string("submenu"));
+	return g_variant_new("(i@a{sv}@av)",
+	                     0,
+	                     g_variant_builder_end(&props),
+	                     g_variant_builder_end(&children));
+}
+
+static GVariant *layout_level(uint level, uint depth, uint width)
+{
+	GVariantBuilder children;
+	g_variant_builder_init(&children, G_VARIANT_TYPE("av"));
+	for (uint i = 0; i < width; i++)
+	{
+		int id                 = (int)(level * width + i + 1);
+		g_autofree char *label = g_strdup_printf("Level %u item %u", level, i + 1);
+		GVariant *submenu      = i == 0 && level + 1 < depth
+		                             ? layout_level(level + 1, depth, width)
+		                             : NULL;
+		g_variant_builder_add(&children, "v", test_layout_item(id, label, submenu));
+	}
+	return g_variant_builder_end(&children);
+}
+
+/* Root layout of depth levels with width items each. First item of every level but the last
+ * opens the next level, so the tree has depth * width items.
+ */
+GVariant *test_layout_nested(uint depth, uint width)
+{
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&props,
+	                      "{sv}",
+	                      "children-display",
+	                      g_variant_new_string("submenu"));
+	return g_variant_new("(i@a{sv}@av)",
+	                     0,
+	                     g_variant_builder_end(&props),
+	                     layout_level(0, depth, width));
+}
+
+/* Reads a layout stored in GVariant text format, replacing every occurrence of from with to
+ * if from is set. Result is serialized like a GetLayout reply, not in the tree form of the
+ * text parser.
+ */
+GVariant *test_layout_load(const char *path, const char *from, const char *to)
+{
+	g_autoptr(GError) error = NULL;
+	g_autofree char *text   = NULL;
+	g_file_get_contents(path, &text, NULL, &error);
+	g_assert_no_error(error);
+	if (from != NULL)
+	{
+		g_auto(GStrv) parts = g_strsplit(text, from, -1);
+		g_free(text);
+		text = g_strjoinv(to, parts);
+	}
+	g_autoptr(GVariant) layout =
+	    g_variant_parse(G_VARIANT_TYPE("(ia{sv}av)"), text, NULL, NULL, &error);
+	g_assert_no_error(error);
+	return g_variant_get_normal_form(layout);
+}
+
+// Number of items under node, at all depths
+uint test_layout_count(GVariant *node)
+{
+	g_autoptr(GVariant) children = g_variant_get_child_value(node, 2);
+	uint count                   = 0;
+	for (gsize i = 0; i < g_variant_n_children(children); i++)
+	{
+		g_autoptr(GVariant) child = g_variant_get_child_value(children, i);
+		g_autoptr(GVariant) value = g_variant_get_variant(child);
+		count += 1 + test_layout_count(value);
+	}
+	return count;
+}
+
+// Number of items under node which are shown as menu items, separators are not
+uint test_layout_count_items(GVariant *node)
+{
+	g_autoptr(GVariant) children = g_variant_get_child_value(node, 2);
+	uint count                   = 0;
+	for (gsize i = 0; i < g_variant_n_children(children); i++)
+	{
+		g_autoptr(GVariant) child = g_variant_get_child_value(children, i);
+		g_autoptr(GVariant) value = g_variant_get_variant(child);
+		g_autoptr(GVariant) props = g_variant_get_child_value(value, 1);
+		const char *type          = NULL;
+		g_variant_lookup(props, "type", "&s", &type);
+		if (g_strcmp0(type, "separator") != 0)
+			count++;
+		count += test_layout_count_items(value);
+	}
+	return count;
+}
+
+/* Private connection to the session bus. Calls still waiting for replies keep it alive, and
+ * the shared session connection must be gone when GTestDBus shuts the bus down.
+ */
+GDBusConnection *test_bus_connection_new(void)
+{
+	g_autoptr(GError) error = NULL;
+	g_autofree char *address =
+	    g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, NULL, &error);
+	g_assert_no_error(error);
+	GDBusConnectionFlags flags = G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+	                             G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION;
+	GDBusConnection *connection =
+	    g_dbus_connection_new_for_address_sync(address, flags, NULL, NULL, &error);
+	g_assert_no_error(error);
+	return connection;
+}
+
+double test_elapsed_ms(gint64 start)
+{
+	return (double)(g_get_monotonic_time() - start) / 1000.0;
+}
+
+static gint64 read_status_kb(const char *field)
+{
+	g_autofree char *status = NULL;
+	if (!g_file_get_contents("/proc/self/status", &status, NULL, NULL))
+		return -1;
+	const char *line = strstr(status, field);
+	if (line == NULL)
+		return -1;
+	return g_ascii_strtoll(line + strlen(field), NULL, 10);
+}
+
+// Bytes allocated from the heap, or -1 where the C library does not report them
+gint64 test_heap_bytes(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 info = mallinfo2();
+	return (gint64)(info.uordblks + info.hblkhd);
+#else
+	return -1;
+#endif
+}
+
+// Resident set size in KiB, or -1 where /proc is not available
+gint64 test_rss_kb(void)
+{
+	return read_status_kb("VmRSS:");
+}
+
+gint64 test_peak_rss_kb(void)
+{
+	return read_status_kb("VmHWM:");
+}
@@ -0,0 +1,45 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TESTS_COMMON_H
+#define TESTS_COMMON_H
+
+#include <gio/gio.h>
+#include <stdbool.h>
+
+G_BEGIN_DECLS
+
+// Ids of generated separators, kept apart from item ids
+#define TEST_SEPARATOR_ID 1000000
+
+GVariant *test_layout_item(int id, const char *label, GVariant *children);
+GVariant *test_layout_separator(int id);
+GVariant *test_layout_flat(uint n_items, uint section_size, uint revision);
+GVariant *test_layout_nested(uint depth, uint width);
+GVariant *test_layout_load(const char *path, const char *from, const char *to);
+uint test_layout_count(GVariant *node);
+uint test_layout_count_items(GVariant *node);
+GDBusConnection *test_bus_connection_new(void);
+double test_elapsed_ms(gint64 start);
+gint64 test_heap_bytes(void);
+gint64 test_rss_kb(void);
+gint64 test_peak_rss_kb(void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "dbusmenu-interface.h"
+#include "fake-server.h"
+
+/* Minimal com.canonical.dbusmenu server for tests. It serves one layout tree from its own
+ * connection and thread, so replies held back by configured delays never block the client
+ * under test, which runs in the main thread.
+ */
+struct _FakeServer
+{
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+	GDBusConnection *connection;
+	char *object_path;
+	uint registration_id;
+	GMutex lock;
+	GCond ready;
+	bool started;
+	GVariant *layout;
+	uint revision;
+	int last_clicked;
+	GHashTable *delays;
+	GHashTable *calls;
+};
+
+typedef struct
+{
+	GDBusMethodInvocation *invocation;
+	GVariant *reply;
+} FakeReply;
+
+static bool fake_reply_send(FakeReply *reply)
+{
+	g_dbus_method_invocation_return_value(g_steal_pointer(&reply->invocation),
+	                                      g_steal_pointer(&reply->reply));
+	return G_SOURCE_REMOVE;
+}
+
+// Replies still held when the server stops are dropped
+static void fake_reply_free(FakeReply *reply)
+{
+	g_clear_object(&reply->invocation);
+	g_clear_pointer(&reply->reply, g_variant_unref);
+	g_free(reply);
+}
+
+static GVariant *find_node(GVariant *node, int id)
+{
+	int node_id;
+	g_variant_get_child(node, 0, "i", &node_id);
+	if (node_id == id)
+		return g_variant_ref(node);
+	g_autoptr(GVariant) children = g_variant_get_child_value(node, 2);
+	for (gsize i = 0; i < g_variant_n_children(children); i++)
+	{
+		g_autoptr(GVariant) child = g_variant_get_child_value(children, i);
+		g_autoptr(GVariant) value = g_variant_get_variant(child);
+		GVariant *found           = find_node(value, id);
+		if (found != NULL)
+			return found;
+	}
+	return NULL;
+}
+
+static GVariant *fake_server_group_properties(FakeServer *server, GVariant *parameters)
+{
+	g_autoptr(GVariant) ids = g_variant_get_child_value(parameters, 0);
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ia{sv})"));
+	for (gsize i = 0; i < g_variant_n_children(ids); i++)
+	{
+		int id;
+		g_variant_get_child(ids, i, "i", &id);
+		g_autoptr(GVariant) node = find_node(server->layout, id);
+		if (node == NULL)
+			continue;
+		g_autoptr(GVariant) props = g_variant_get_child_value(node, 1);
+		g_variant_builder_add(&builder, "(i@a{sv})", id, props);
+	}
+	return g_variant_new("(a(ia{sv}))", &builder);
+}
+
+static GVariant *fake_server_reply(FakeServer *server, const char *method_name,
+                                   GVariant *parameters)
+{
+	if (g_strcmp0(method_name, "GetLayout") == 0)
+	{
+		int parent_id;
+		g_variant_get_child(parameters, 0, "i", &parent_id);
+		g_autoptr(GVariant) node = find_node(server->layout, parent_id);
+		if (node == NULL)
+			return NULL;
+		return g_variant_new("(u@(ia{sv}av))", server->revision, node);
+	}
+	if (g_strcmp0(method_name, "GetGroupProperties") == 0)
+		return fake_server_group_properties(server, parameters);
+	if (g_strcmp0(method_name, "AboutToShow") == 0)
+		return g_variant_new("(b)", true);
+	if (g_strcmp0(method_name, "AboutToShowGroup") == 0)
+	{
+		g_autoptr(GVariant) ids = g_variant_get_child_value(parameters, 0);
+		return g_variant_new("(@ai@ai)",
+		                     ids,
+		                     g_variant_new_array(G_VARIANT_TYPE_INT32, NULL, 0));
+	}
+	if (g_strcmp0(method_name, "EventGroup") == 0)
+		return g_variant_new("(@ai)", g_variant_new_array(G_VARIANT_TYPE_INT32, NULL, 0));
+	if (g_strcmp0(method_name, "Event") == 0)
+	{
+		int id;
+		const char *event_id;
+		g_variant_get(parameters, "(i&svu)", &id, &event_id, NULL, NULL);
+		if (g_strcmp0(event_id, "clicked") == 0)
+			server->last_clicked = id;
+		return g_variant_new("()");
+	}
+	return NULL;
+}
+
+static void fake_server_method_call(GDBusConnection *connection, const char *sender,
+                                    const char *object_path, const char *interface_name,
+                                    const char *method_name, GVariant *parameters,
+                                    GDBusMethodInvocation *invocation, gpointer user_data)
+{
+	FakeServer *server = (FakeServer *)user_data;
+	g_mutex_lock(&server->lock);
+	uint calls = GPOINTER_TO_UINT(g_hash_table_lookup(server->calls, method_name));
+	g_hash_table_insert(server->calls, g_strdup(method_name), GUINT_TO_POINTER(calls + 1));
+	uint delay       = GPOINTER_TO_UINT(g_hash_table_lookup(server->delays, method_name));
+	GVariant *result = fake_server_reply(server, method_name, parameters);
+	g_mutex_unlock(&server->lock);
+	if (result == NULL)
+	{
+		g_dbus_method_invocation_return_error(invocation,
+		                                      G_DBUS_ERROR,
+		                                      G_DBUS_ERROR_INVALID_ARGS,
+		                                      "%s is not supported for these arguments",
+		                                      method_name);
+		return;
+	}
+	FakeReply *reply  = g_new0(FakeReply, 1);
+	reply->invocation = invocation;
+	reply->reply      = g_variant_ref_sink(result);
+	GSource *source   = g_timeout_source_new(delay);
+	g_source_set_callback(source,
+	                      (GSourceFunc)fake_reply_send,
+	                      reply,
+	                      (GDestroyNotify)fake_reply_free);
+	g_source_attach(source, server->context);
+	g_source_unref(source);
+}
+
+static GVariant *fake_server_get_property(GDBusConnection *connection, const char *sender,
+                                          const char *object_path, const char *interface_name,
+                                          const char *property_name, GError **error,
+                                          gpointer user_data)
+{
+	if (g_strcmp0(property_name, "Version") == 0)
+		return g_variant_new_uint32(3);
+	if (g_strcmp0(property_name, "Status") == 0)
+		return g_variant_new_string("normal");
+	if (g_strcmp0(property_name, "TextDirection") == 0)
+		return g_variant_new_string("ltr");
+	return g_variant_new_strv(NULL, 0);
+}
+
+static const GDBusInterfaceVTable fake_server_vtable = {
+	fake_server_method_call,
+	fake_server_get_property,
+	NULL,
+};
+
+static gpointer fake_server_thread(gpointer data)
+{
+	FakeServer *server      = (FakeServer *)data;
+	g_autoptr(GError) error = NULL;
+	g_main_context_push_thread_default(server->context);
+	server->connection = test_bus_connection_new();
+	server->registration_id =
+	    g_dbus_connection_register_object(server->connection,
+	                                      server->object_path,
+	                                      dbus_menu_xml_interface_info(),
+	                                      &fake_server_vtable,
+	                                      server,
+	                                      NULL,
+	                                      &error);
+	g_assert_no_error(error);
+	g_mutex_lock(&server->lock);
+	server->started = true;
+	g_cond_signal(&server->ready);
+	g_mutex_unlock(&server->lock);
+
+	g_main_loop_run(server->loop);
+
+	g_dbus_connection_unregister_object(server->connection, server->registration_id);
+	g_dbus_connection_close_sync(server->connection, NULL, NULL);
+	g_clear_object(&server->connection);
+	g_main_context_pop_thread_default(server->context);
+	return NULL;
+}
+
+// Needs a session bus, usually the one of GTestDBus. Returns when the menu is exported.
+FakeServer *fake_server_new(const char *object_path, GVariant *layout)
+{
+	FakeServer *server  = g_new0(FakeServer, 1);
+	server->context     = g_main_context_new();
+	server->loop        = g_main_loop_new(server->context, false);
+	server->object_path = g_strdup(object_path);
+	server->layout      = g_variant_take_ref(layout);
+	server->revision    = 1;
+	server->delays      = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	server->calls       = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	g_mutex_init(&server->lock);
+	g_cond_init(&server->ready);
+	server->thread = g_thread_new("fake-server", fake_server_thread, server);
+	g_mutex_lock(&server->lock);
+	while (!server->started)
+		g_cond_wait(&server->ready, &server->lock);
+	g_mutex_unlock(&server->lock);
+	return server;
+}
+
+const char *fake_server_get_name(FakeServer *server)
+{
+	return g_dbus_connection_get_unique_name(server->connection);
+}
+
+// Replaces the served layout and announces it with LayoutUpdated for the root
+void fake_server_set_layout(FakeServer *server, GVariant *layout, uint revision)
+{
+	g_mutex_lock(&server->lock);
+	g_clear_pointer(&server->layout, g_variant_unref);
+	server->layout   = g_variant_take_ref(layout);
+	server->revision = revision;
+	g_mutex_unlock(&server->lock);
+	g_dbus_connection_emit_signal(server->connection,
+	                              NULL,
+	                              server->object_path,
+	                              "com.canonical.dbusmenu",
+	                              "LayoutUpdated",
+	                              g_variant_new("(ui)", revision, 0),
+	                              NULL);
+}
+
+// Announces a new label of item id with ItemsPropertiesUpdated, the served layout is kept
+void fake_server_emit_label(FakeServer *server, int id, const char *label)
+{
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&props, "{sv}", "label", g_variant_new_string(label));
+	GVariantBuilder updated;
+	g_variant_builder_init(&updated, G_VARIANT_TYPE("a(ia{sv})"));
+	g_variant_builder_add(&updated, "(i@a{sv})", id, g_variant_builder_end(&props));
+	g_dbus_connection_emit_signal(server->connection,
+	                              NULL,
+	                              server->object_path,
+	                              "com.canonical.dbusmenu",
+	                              "ItemsPropertiesUpdated",
+	                              g_variant_new("(@a(ia{sv})@a(ias))",
+	                                            g_variant_builder_end(&updated),
+	                                            g_variant_new_array(G_VARIANT_TYPE("(ias)"),
+	                                                                NULL,
+	                                                                0)),
+	                              NULL);
+}
+
+// Replies to method are sent delay_ms after the call arrives
+void fake_server_set_delay(FakeServer *server, const char *method, uint delay_ms)
+{
+	g_mutex_lock(&server->lock);
+	g_hash_table_insert(server->delays, g_strdup(method), GUINT_TO_POINTER(delay_ms));
+	g_mutex_unlock(&server->lock);
+}
+
+uint fake_server_get_calls(FakeServer *server, const char *method)
+{
+	g_mutex_lock(&server->lock);
+	uint calls = GPOINTER_TO_UINT(g_hash_table_lookup(server->calls, method));
+	g_mutex_unlock(&server->lock);
+	return calls;
+}
+
+// Id of the item of the latest "clicked" event, or 0 if there was none
+int fake_server_get_last_clicked(FakeServer *server)
+{
+	g_mutex_lock(&server->lock);
+	int id = server->last_clicked;
+	g_mutex_unlock(&server->lock);
+	return id;
+}
+
+static bool fake_server_quit(GMainLoop *loop)
+{
+	g_main_loop_quit(loop);
+	return G_SOURCE_REMOVE;
+}
+
+void fake_server_free(FakeServer *server)
+{
+	// Quit is dispatched by the server loop itself, so it cannot come before the loop runs
+	g_main_context_invoke(server->context, (GSourceFunc)fake_server_quit, server->loop);
+	g_thread_join(server->thread);
+	g_main_loop_unref(server->loop);
+	g_main_context_unref(server->context);
+	g_hash_table_unref(server->delays);
+	g_hash_table_unref(server->calls);
+	g_clear_pointer(&server->layout, g_variant_unref);
+	g_mutex_clear(&server->lock);
+	g_cond_clear(&server->ready);
+	g_free(server->object_path);
+	g_free(server);
+}
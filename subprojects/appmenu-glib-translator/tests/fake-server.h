@@ -0,0 +1,39 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TESTS_FAKE_SERVER_H
+#define TESTS_FAKE_SERVER_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _FakeServer FakeServer;
+
+FakeServer *fake_server_new(const char *object_path, GVariant *layout);
+const char *fake_server_get_name(FakeServer *server);
+void fake_server_set_layout(FakeServer *server, GVariant *layout, uint revision);
+void fake_server_emit_label(FakeServer *server, int id, const char *label);
+void fake_server_set_delay(FakeServer *server, const char *method, uint delay_ms);
+uint fake_server_get_calls(FakeServer *server, const char *method);
+int fake_server_get_last_clicked(FakeServer *server);
+void fake_server_free(FakeServer *server);
+
+G_END_DECLS
+
+#endif
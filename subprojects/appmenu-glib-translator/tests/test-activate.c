@@ -0,0 +1,166 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Clicks must not wait for the client. The fake server holds its Event replies for seconds,
+ * and activation still returns at once, the click reaches the server while the reply is
+ * pending, and checkbox state is changed locally without waiting for the client.
+ */
+
+#include "actions.h"
+#include "common.h"
+#include "fake-server.h"
+#include "model.h"
+
+#define MENU_PATH "/MenuBar"
+#define BUILD_ID 1
+#define WRAP_ID 2
+#define EVENT_REPLY_MS 3000
+#define DEADLINE_MS 2000
+
+static GVariant *checkmark_item(int id, const char *label)
+{
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&props, "{sv}", "label", g_variant_new_string(label));
+	g_variant_builder_add(&props, "{sv}", "toggle-type", g_variant_new_string("checkmark"));
+	g_variant_builder_add(&props, "{sv}", "toggle-state", g_variant_new_int32(0));
+	return g_variant_new("(i@a{sv}@av)",
+	                     id,
+	                     g_variant_builder_end(&props),
+	                     g_variant_new_array(G_VARIANT_TYPE_VARIANT, NULL, 0));
+}
+
+static GVariant *menubar_layout(void)
+{
+	GVariantBuilder root;
+	g_variant_builder_init(&root, G_VARIANT_TYPE("av"));
+	g_variant_builder_add(&root, "v", test_layout_item(BUILD_ID, "Build", NULL));
+	g_variant_builder_add(&root, "v", checkmark_item(WRAP_ID, "Word Wrap"));
+	return test_layout_item(0, "", g_variant_builder_end(&root));
+}
+
+typedef struct
+{
+	FakeServer *server;
+	GDBusConnection *connection;
+	DBusMenuXml *xml;
+	DBusMenuActionGroup *actions;
+	DBusMenuModel *menu;
+} Fixture;
+
+static void fixture_set_up(Fixture *fixture, gconstpointer data)
+{
+	g_autoptr(GError) error    = NULL;
+	g_autoptr(GVariant) layout = g_variant_ref_sink(menubar_layout());
+	fixture->server            = fake_server_new(MENU_PATH, g_variant_ref(layout));
+	fake_server_set_delay(fixture->server, "Event", EVENT_REPLY_MS);
+	fixture->connection = test_bus_connection_new();
+	fixture->xml = dbus_menu_xml_proxy_new_sync(fixture->connection,
+	                                            G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+	                                                G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+	                                            fake_server_get_name(fixture->server),
+	                                            MENU_PATH,
+	                                            NULL,
+	                                            &error);
+	g_assert_no_error(error);
+	fixture->actions = dbus_menu_action_group_new();
+	dbus_menu_action_group_set_xml(fixture->actions, fixture->xml);
+	// Actions come from items, the layout itself is not needed from the bus here
+	fixture->menu = dbus_menu_model_new(0, NULL, NULL, G_ACTION_GROUP(fixture->actions));
+	dbus_menu_model_apply_layout(fixture->menu, layout);
+}
+
+// Calls still waiting for delayed replies keep the private connection until exit
+static void fixture_tear_down(Fixture *fixture, gconstpointer data)
+{
+	g_clear_object(&fixture->menu);
+	g_clear_object(&fixture->actions);
+	g_clear_object(&fixture->xml);
+	g_clear_object(&fixture->connection);
+	fake_server_free(fixture->server);
+}
+
+// Activates action and runs the main loop until the server sees the click
+static void activate_and_wait(Fixture *fixture, const char *action, int id)
+{
+	gint64 start = g_get_monotonic_time();
+	g_action_group_activate_action(G_ACTION_GROUP(fixture->actions), action, NULL);
+	g_assert_cmpfloat(test_elapsed_ms(start), <, EVENT_REPLY_MS / 10);
+	// Nothing happens on the client side meanwhile, so the loop is polled
+	while (fake_server_get_last_clicked(fixture->server) != id &&
+	       test_elapsed_ms(start) < DEADLINE_MS)
+	{
+		g_main_context_iteration(NULL, false);
+		g_usleep(1000);
+	}
+	double elapsed = test_elapsed_ms(start);
+	g_print("click of %d delivered after %.1f ms\n", id, elapsed);
+	g_assert_cmpint(fake_server_get_last_clicked(fixture->server), ==, id);
+	g_assert_cmpfloat(elapsed, <, EVENT_REPLY_MS);
+}
+
+static void test_activate_delayed_reply(Fixture *fixture, gconstpointer data)
+{
+	activate_and_wait(fixture, ACTION_PREFIX "1", BUILD_ID);
+	g_assert_cmpuint(fake_server_get_calls(fixture->server, "Event"), ==, 1);
+}
+
+static void test_activate_checkbox(Fixture *fixture, gconstpointer data)
+{
+	GActionGroup *group        = G_ACTION_GROUP(fixture->actions);
+	g_autoptr(GVariant) before = g_action_group_get_action_state(group, ACTION_PREFIX "2");
+	g_assert_false(g_variant_get_boolean(before));
+	activate_and_wait(fixture, ACTION_PREFIX "2", WRAP_ID);
+	// State is changed by activation itself, long before the client answers
+	g_autoptr(GVariant) after = g_action_group_get_action_state(group, ACTION_PREFIX "2");
+	g_assert_true(g_variant_get_boolean(after));
+}
+
+static void test_activate_no_reply(Fixture *fixture, gconstpointer data)
+{
+	dbus_menu_action_group_set_no_reply(fixture->actions, true);
+	activate_and_wait(fixture, ACTION_PREFIX "1", BUILD_ID);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_autoptr(GTestDBus) bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(bus);
+	g_test_add("/activate/delayed-reply",
+	           Fixture,
+	           NULL,
+	           fixture_set_up,
+	           test_activate_delayed_reply,
+	           fixture_tear_down);
+	g_test_add("/activate/checkbox",
+	           Fixture,
+	           NULL,
+	           fixture_set_up,
+	           test_activate_checkbox,
+	           fixture_tear_down);
+	g_test_add("/activate/no-reply",
+	           Fixture,
+	           NULL,
+	           fixture_set_up,
+	           test_activate_no_reply,
+	           fixture_tear_down);
+	int ret = g_test_run();
+	g_test_dbus_down(bus);
+	return ret;
+}
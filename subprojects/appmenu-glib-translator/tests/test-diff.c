@@ -0,0 +1,337 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Exact items-changed ranges of layout updates. Serial diffs are checked on their own, then
+ * whole layouts are applied to a model and ranges are collected from its section models,
+ * which report item changes, and from the root model, which reports only changes of the
+ * section count.
+ */
+
+#include "actions.h"
+#include "common.h"
+#include "model.h"
+
+// Layout entry for a separator
+#define SEP 0
+
+typedef struct
+{
+	int section;
+	int position;
+	int removed;
+	int added;
+} Range;
+
+typedef struct
+{
+	GArray *ranges;
+	int section;
+} Listener;
+
+static void record_range(GMenuModel *model, int position, int removed, int added,
+                         Listener *listener)
+{
+	Range range = { listener->section, position, removed, added };
+	g_array_append_val(listener->ranges, range);
+}
+
+static void assert_ranges(GArray *ranges, const Range *expected, uint n_expected)
+{
+	for (uint i = 0; i < ranges->len; i++)
+	{
+		Range *range = &g_array_index(ranges, Range, i);
+		g_test_message("section %d: %d -%d +%d",
+		               range->section,
+		               range->position,
+		               range->removed,
+		               range->added);
+	}
+	g_assert_cmpuint(ranges->len, ==, n_expected);
+	for (uint i = 0; i < n_expected; i++)
+	{
+		Range *range = &g_array_index(ranges, Range, i);
+		g_assert_cmpint(range->section, ==, expected[i].section);
+		g_assert_cmpint(range->position, ==, expected[i].position);
+		g_assert_cmpint(range->removed, ==, expected[i].removed);
+		g_assert_cmpint(range->added, ==, expected[i].added);
+	}
+}
+
+static GArray *serial_diff(const uint *old_serials, uint n_old, const uint *new_serials,
+                           uint n_new)
+{
+	g_autoptr(GMenu) section    = g_menu_new();
+	g_autoptr(GArray) old_array = g_array_new(false, false, sizeof(uint));
+	g_autoptr(GArray) new_array = g_array_new(false, false, sizeof(uint));
+	g_array_append_vals(old_array, old_serials, n_old);
+	g_array_append_vals(new_array, new_serials, n_new);
+	Listener listener = { g_array_new(false, false, sizeof(Range)), 0 };
+	g_signal_connect(section, "items-changed", G_CALLBACK(record_range), &listener);
+	dbus_menu_model_emit_section_diff(G_MENU_MODEL(section), old_array, new_array);
+	return listener.ranges;
+}
+
+static void test_serials_unchanged(void)
+{
+	const uint serials[] = { 1, 2, 3 };
+	g_autoptr(GArray) ranges = serial_diff(serials, 3, serials, 3);
+	assert_ranges(ranges, NULL, 0);
+}
+
+static void test_serials_insert(void)
+{
+	const uint old_serials[] = { 1, 2, 3 };
+	const uint new_serials[] = { 1, 4, 2, 3 };
+	const Range expected[]   = { { 0, 1, 0, 1 } };
+	g_autoptr(GArray) ranges = serial_diff(old_serials, 3, new_serials, 4);
+	assert_ranges(ranges, expected, G_N_ELEMENTS(expected));
+}
+
+static void test_serials_delete(void)
+{
+	const uint old_serials[] = { 1, 2, 3 };
+	const uint new_serials[] = { 1, 3 };
+	const Range expected[]   = { { 0, 1, 1, 0 } };
+	g_autoptr(GArray) ranges = serial_diff(old_serials, 3, new_serials, 2);
+	assert_ranges(ranges, expected, G_N_ELEMENTS(expected));
+}
+
+static void test_serials_move(void)
+{
+	const uint old_serials[] = { 1, 2, 3 };
+	const uint new_serials[] = { 2, 3, 1 };
+	const Range expected[]   = { { 0, 0, 1, 0 }, { 0, 2, 0, 1 } };
+	g_autoptr(GArray) ranges = serial_diff(old_serials, 3, new_serials, 3);
+	assert_ranges(ranges, expected, G_N_ELEMENTS(expected));
+}
+
+static void test_serials_replace(void)
+{
+	const uint old_serials[] = { 1, 2, 3 };
+	const uint new_serials[] = { 1, 5, 3 };
+	const Range expected[]   = { { 0, 1, 1, 1 } };
+	g_autoptr(GArray) ranges = serial_diff(old_serials, 3, new_serials, 3);
+	assert_ranges(ranges, expected, G_N_ELEMENTS(expected));
+}
+
+static void test_serials_fill_and_clear(void)
+{
+	const uint serials[]    = { 1, 2 };
+	const Range filled[]    = { { 0, 0, 0, 2 } };
+	const Range cleared[]   = { { 0, 0, 2, 0 } };
+	g_autoptr(GArray) fill  = serial_diff(NULL, 0, serials, 2);
+	g_autoptr(GArray) clear = serial_diff(serials, 2, NULL, 0);
+	assert_ranges(fill, filled, G_N_ELEMENTS(filled));
+	assert_ranges(clear, cleared, G_N_ELEMENTS(cleared));
+}
+
+typedef struct
+{
+	DBusMenuActionGroup *actions;
+	DBusMenuModel *menu;
+	GArray *ranges;
+	GPtrArray *sections;
+	Listener listeners[8];
+} Fixture;
+
+// Items are labelled by id, except renamed_id. SEP entries become separators.
+static GVariant *layout_of(const uint *ids, uint n_ids, uint renamed_id)
+{
+	GVariantBuilder children;
+	g_variant_builder_init(&children, G_VARIANT_TYPE("av"));
+	for (uint i = 0; i < n_ids; i++)
+	{
+		if (ids[i] == SEP)
+		{
+			g_variant_builder_add(&children,
+			                      "v",
+			                      test_layout_separator(TEST_SEPARATOR_ID + i));
+			continue;
+		}
+		g_autofree char *label = ids[i] == renamed_id ? g_strdup("Renamed")
+		                                              : g_strdup_printf("Item %u", ids[i]);
+		g_variant_builder_add(&children, "v", test_layout_item(ids[i], label, NULL));
+	}
+	return test_layout_item(0, "", g_variant_builder_end(&children));
+}
+
+static void apply(Fixture *fixture, const uint *ids, uint n_ids, uint renamed_id)
+{
+	g_autoptr(GVariant) layout = g_variant_ref_sink(layout_of(ids, n_ids, renamed_id));
+	dbus_menu_model_apply_layout(fixture->menu, layout);
+}
+
+// Applies the first layout, then listens to the root model and to all sections it has
+static void fixture_start(Fixture *fixture, const uint *ids, uint n_ids)
+{
+	fixture->actions  = dbus_menu_action_group_new();
+	fixture->menu     = dbus_menu_model_new(0, NULL, NULL, G_ACTION_GROUP(fixture->actions));
+	fixture->ranges   = g_array_new(false, false, sizeof(Range));
+	fixture->sections = g_ptr_array_new_with_free_func(g_object_unref);
+	apply(fixture, ids, n_ids, 0);
+	GMenuModel *root = G_MENU_MODEL(fixture->menu);
+	int n_sections   = g_menu_model_get_n_items(root);
+	g_assert_cmpint(n_sections, <, G_N_ELEMENTS(fixture->listeners));
+	for (int i = -1; i < n_sections; i++)
+	{
+		GMenuModel *model =
+		    i < 0 ? g_object_ref(root)
+		          : g_menu_model_get_item_link(root, i, G_MENU_LINK_SECTION);
+		fixture->listeners[i + 1] = (Listener){ fixture->ranges, i };
+		g_signal_connect(model,
+		                 "items-changed",
+		                 G_CALLBACK(record_range),
+		                 &fixture->listeners[i + 1]);
+		g_ptr_array_add(fixture->sections, model);
+	}
+}
+
+static void fixture_tear_down(Fixture *fixture, gconstpointer data)
+{
+	for (uint i = 0; i < fixture->sections->len; i++)
+		g_signal_handlers_disconnect_by_func(g_ptr_array_index(fixture->sections, i),
+		                                     record_range,
+		                                     &fixture->listeners[i]);
+	g_clear_pointer(&fixture->sections, g_ptr_array_unref);
+	g_clear_pointer(&fixture->ranges, g_array_unref);
+	g_clear_object(&fixture->menu);
+	g_clear_object(&fixture->actions);
+}
+
+static uint item_id(Fixture *fixture, uint section_num, int place)
+{
+	return dbus_menu_model_get_section_item(fixture->menu, section_num, place)->id;
+}
+
+static void test_layout_unchanged(Fixture *fixture, gconstpointer data)
+{
+	const uint ids[] = { 1, 2, SEP, 3 };
+	fixture_start(fixture, ids, G_N_ELEMENTS(ids));
+	apply(fixture, ids, G_N_ELEMENTS(ids), 0);
+	assert_ranges(fixture->ranges, NULL, 0);
+}
+
+static void test_layout_insert(Fixture *fixture, gconstpointer data)
+{
+	const uint before[]    = { 1, 2, 3 };
+	const uint after[]     = { 1, 4, 2, 3 };
+	const Range expected[] = { { 0, 1, 0, 1 } };
+	fixture_start(fixture, before, G_N_ELEMENTS(before));
+	apply(fixture, after, G_N_ELEMENTS(after), 0);
+	assert_ranges(fixture->ranges, expected, G_N_ELEMENTS(expected));
+	g_assert_cmpuint(item_id(fixture, 0, 1), ==, 4);
+	g_assert_cmpuint(item_id(fixture, 0, 2), ==, 2);
+}
+
+static void test_layout_delete(Fixture *fixture, gconstpointer data)
+{
+	const uint before[]    = { 1, 2, 3, 4 };
+	const uint after[]     = { 1, 3, 4 };
+	const Range expected[] = { { 0, 1, 1, 0 } };
+	fixture_start(fixture, before, G_N_ELEMENTS(before));
+	apply(fixture, after, G_N_ELEMENTS(after), 0);
+	assert_ranges(fixture->ranges, expected, G_N_ELEMENTS(expected));
+	g_assert_null(dbus_menu_model_get_item(fixture->menu, 2));
+	g_assert_cmpuint(dbus_menu_model_get_section_n_items(fixture->menu, 0), ==, 3);
+}
+
+static void test_layout_move(Fixture *fixture, gconstpointer data)
+{
+	const uint before[]    = { 1, 2, 3 };
+	const uint after[]     = { 2, 3, 1 };
+	const Range expected[] = { { 0, 0, 1, 0 }, { 0, 2, 0, 1 } };
+	fixture_start(fixture, before, G_N_ELEMENTS(before));
+	DBusMenuItem *moved = dbus_menu_model_get_item(fixture->menu, 1);
+	apply(fixture, after, G_N_ELEMENTS(after), 0);
+	assert_ranges(fixture->ranges, expected, G_N_ELEMENTS(expected));
+	// Moved item is kept, not rebuilt
+	g_assert_true(dbus_menu_model_get_section_item(fixture->menu, 0, 2) == moved);
+}
+
+static void test_layout_relabel(Fixture *fixture, gconstpointer data)
+{
+	const uint ids[]       = { 1, 2, 3 };
+	const Range expected[] = { { 0, 1, 1, 1 } };
+	fixture_start(fixture, ids, G_N_ELEMENTS(ids));
+	apply(fixture, ids, G_N_ELEMENTS(ids), 2);
+	assert_ranges(fixture->ranges, expected, G_N_ELEMENTS(expected));
+	g_autofree char *label = NULL;
+	GMenuModel *section    = g_ptr_array_index(fixture->sections, 1);
+	g_assert_true(
+	    g_menu_model_get_item_attribute(section, 1, G_MENU_ATTRIBUTE_LABEL, "s", &label));
+	g_assert_cmpstr(label, ==, "Renamed");
+}
+
+static void test_layout_split(Fixture *fixture, gconstpointer data)
+{
+	const uint before[]    = { 1, 2, 3 };
+	const uint after[]     = { 1, SEP, 2, 3 };
+	const Range expected[] = { { 0, 1, 2, 0 }, { -1, 1, 0, 1 } };
+	fixture_start(fixture, before, G_N_ELEMENTS(before));
+	apply(fixture, after, G_N_ELEMENTS(after), 0);
+	assert_ranges(fixture->ranges, expected, G_N_ELEMENTS(expected));
+	g_assert_cmpuint(item_id(fixture, 1, 0), ==, 2);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/diff/serials/unchanged", test_serials_unchanged);
+	g_test_add_func("/diff/serials/insert", test_serials_insert);
+	g_test_add_func("/diff/serials/delete", test_serials_delete);
+	g_test_add_func("/diff/serials/move", test_serials_move);
+	g_test_add_func("/diff/serials/replace", test_serials_replace);
+	g_test_add_func("/diff/serials/fill-and-clear", test_serials_fill_and_clear);
+	g_test_add("/diff/layout/unchanged",
+	           Fixture,
+	           NULL,
+	           NULL,
+	           test_layout_unchanged,
+	           fixture_tear_down);
+	g_test_add("/diff/layout/insert",
+	           Fixture,
+	           NULL,
+	           NULL,
+	           test_layout_insert,
+	           fixture_tear_down);
+	g_test_add("/diff/layout/delete",
+	           Fixture,
+	           NULL,
+	           NULL,
+	           test_layout_delete,
+	           fixture_tear_down);
+	g_test_add("/diff/layout/move",
+	           Fixture,
+	           NULL,
+	           NULL,
+	           test_layout_move,
+	           fixture_tear_down);
+	g_test_add("/diff/layout/relabel",
+	           Fixture,
+	           NULL,
+	           NULL,
+	           test_layout_relabel,
+	           fixture_tear_down);
+	g_test_add("/diff/layout/split",
+	           Fixture,
+	           NULL,
+	           NULL,
+	           test_layout_split,
+	           fixture_tear_down);
+	return g_test_run();
+}
@@ -0,0 +1,191 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Replays layouts of several shapes from a fake server and loads each of them with a fresh
+ * importer, the way a panel does when a window gets focus. Reported for every layout:
+ * time until the first item is shown, time until the whole tree is loaded, parse time of the
+ * layout alone, items-changed emissions and peak RSS so far.
+ *
+ * Only the root reports changes of its section count, items are reported by section models.
+ * Models are watched from the moment they are seen in the tree, as a bound menu would watch
+ * them, so emissions made before that are not counted.
+ */
+
+#include "actions.h"
+#include "common.h"
+#include "fake-server.h"
+#include "importer.h"
+#include "model.h"
+
+#define MENU_PATH "/MenuBar"
+#define PARSE_ROUNDS 10
+#define SETTLE_MS 300
+#define DEADLINE_MS 30000
+
+typedef struct
+{
+	const char *name;
+	GVariant *layout;
+} TestLayout;
+
+typedef struct
+{
+	GHashTable *models;
+	uint changes;
+	bool dirty;
+} Watch;
+
+static void on_items_changed(GMenuModel *model, gint position, gint removed, gint added,
+                             Watch *watch)
+{
+	watch->changes++;
+	watch->dirty = true;
+}
+
+// Counts shown items of the tree and starts watching models which were not seen before
+static uint watch_tree(Watch *watch, GMenuModel *model)
+{
+	if (!g_hash_table_contains(watch->models, model))
+	{
+		g_hash_table_add(watch->models, g_object_ref(model));
+		g_signal_connect(model, "items-changed", G_CALLBACK(on_items_changed), watch);
+	}
+	uint ret = 0;
+	for (int i = 0; i < g_menu_model_get_n_items(model); i++)
+	{
+		g_autoptr(GMenuModel) section =
+		    g_menu_model_get_item_link(model, i, G_MENU_LINK_SECTION);
+		g_autoptr(GMenuModel) submenu =
+		    g_menu_model_get_item_link(model, i, G_MENU_LINK_SUBMENU);
+		if (section != NULL)
+			ret += watch_tree(watch, section);
+		else
+			ret++;
+		if (submenu != NULL)
+			ret += watch_tree(watch, submenu);
+	}
+	return ret;
+}
+
+static void unwatch(GMenuModel *model, gpointer value, Watch *watch)
+{
+	g_signal_handlers_disconnect_by_data(model, watch);
+	g_object_unref(model);
+}
+
+static double parse_ms(GVariant *layout)
+{
+	g_autoptr(DBusMenuActionGroup) actions = dbus_menu_action_group_new();
+	gint64 start                           = g_get_monotonic_time();
+	for (uint i = 0; i < PARSE_ROUNDS; i++)
+	{
+		g_autoptr(DBusMenuModel) menu =
+		    dbus_menu_model_new(0, NULL, NULL, G_ACTION_GROUP(actions));
+		dbus_menu_model_set_prefetch(menu, true);
+		dbus_menu_model_apply_layout(menu, layout);
+	}
+	return test_elapsed_ms(start) / PARSE_ROUNDS;
+}
+
+static void test_layouts_replay(gconstpointer data)
+{
+	const TestLayout *test = data;
+	uint expected          = test_layout_count_items(test->layout);
+	FakeServer *server     = fake_server_new(MENU_PATH, g_variant_ref(test->layout));
+	Watch watch            = { 0 };
+	watch.models           = g_hash_table_new(NULL, NULL);
+
+	gint64 start               = g_get_monotonic_time();
+	DBusMenuImporter *importer = g_object_new(dbus_menu_importer_get_type(),
+	                                          "bus-name",
+	                                          fake_server_get_name(server),
+	                                          "object-path",
+	                                          MENU_PATH,
+	                                          "prefetch",
+	                                          true,
+	                                          NULL);
+	g_autoptr(GMenuModel) model = NULL;
+	g_object_get(importer, "model", &model, NULL);
+	watch_tree(&watch, model);
+	double first_ms = -1, loaded_ms = -1;
+	while (loaded_ms < 0 && test_elapsed_ms(start) < DEADLINE_MS)
+	{
+		if (!g_main_context_iteration(NULL, false))
+			g_usleep(1000);
+		if (!watch.dirty)
+			continue;
+		watch.dirty = false;
+		uint shown  = watch_tree(&watch, model);
+		if (first_ms < 0 && shown > 0)
+			first_ms = test_elapsed_ms(start);
+		if (shown == expected)
+			loaded_ms = test_elapsed_ms(start);
+	}
+	// Emissions after the tree is complete are counted too
+	gint64 settle = g_get_monotonic_time();
+	while (test_elapsed_ms(settle) < SETTLE_MS)
+		if (!g_main_context_iteration(NULL, false))
+			g_usleep(1000);
+
+	g_print("%s: %u items\n", test->name, expected);
+	g_print("  first item: %.1f ms, whole tree: %.1f ms\n", first_ms, loaded_ms);
+	g_print("  parse: %.2f ms\n", parse_ms(test->layout));
+	g_print("  items-changed: %u in %u models\n",
+	        watch.changes,
+	        g_hash_table_size(watch.models));
+	g_print("  peak RSS: %" G_GINT64_FORMAT " KiB\n", test_peak_rss_kb());
+	g_assert_cmpfloat(first_ms, >=, 0);
+	g_assert_cmpfloat(loaded_ms, >=, 0);
+	g_assert_cmpuint(watch.changes, >, 0);
+
+	g_hash_table_foreach(watch.models, (GHFunc)unwatch, &watch);
+	g_hash_table_unref(watch.models);
+	g_clear_object(&model);
+	g_object_unref(importer);
+	fake_server_free(server);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	if (argc < 2)
+	{
+		g_printerr("Usage: %s LAYOUT\n", argv[0]);
+		return 1;
+	}
+	// Small layouts first, so peak RSS grows with the layouts
+	TestLayout layouts[] = {
+		{ "/layouts/recorded", test_layout_load(argv[1], NULL, NULL) },
+		{ "/layouts/deep-nested", test_layout_nested(50, 10) },
+		{ "/layouts/flat-500", test_layout_flat(500, 20, 0) },
+		{ "/layouts/flat-5000", test_layout_flat(5000, 20, 0) },
+	};
+	for (uint i = 0; i < G_N_ELEMENTS(layouts); i++)
+	{
+		layouts[i].layout = g_variant_take_ref(layouts[i].layout);
+		g_test_add_data_func(layouts[i].name, &layouts[i], test_layouts_replay);
+	}
+	g_autoptr(GTestDBus) bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(bus);
+	int ret = g_test_run();
+	// Pooled proxies outlive importers for a while, and they hold the session connection
+	g_test_dbus_stop(bus);
+	for (uint i = 0; i < G_N_ELEMENTS(layouts); i++)
+		g_variant_unref(layouts[i].layout);
+	return ret;
+}
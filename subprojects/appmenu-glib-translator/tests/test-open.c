@@ -0,0 +1,177 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Opening a submenu of a slow client must not block the main loop: the model is populated
+ * when AboutToShow and GetLayout answers arrive, and an unanswered AboutToShow is given up
+ * after the model timeout.
+ */
+
+#include "actions.h"
+#include "common.h"
+#include "fake-server.h"
+#include "model.h"
+
+#define MENU_PATH "/MenuBar"
+#define FILE_ID 1
+#define FILE_ITEMS 3
+#define TICK_MS 10
+#define SLOW_REPLY_MS 500
+#define HUNG_REPLY_MS 5000
+#define MODEL_TIMEOUT_MS 200
+#define DEADLINE_MS 10000
+
+static GVariant *menubar_layout(void)
+{
+	GVariantBuilder file;
+	g_variant_builder_init(&file, G_VARIANT_TYPE("av"));
+	for (int i = 1; i <= FILE_ITEMS; i++)
+	{
+		g_autofree char *label = g_strdup_printf("Action %d", i);
+		g_variant_builder_add(&file, "v", test_layout_item(FILE_ID * 100 + i, label, NULL));
+	}
+	GVariantBuilder root;
+	g_variant_builder_init(&root, G_VARIANT_TYPE("av"));
+	g_variant_builder_add(&root,
+	                      "v",
+	                      test_layout_item(FILE_ID, "File", g_variant_builder_end(&file)));
+	return test_layout_item(0, "", g_variant_builder_end(&root));
+}
+
+static bool tick(uint *ticks)
+{
+	(*ticks)++;
+	return G_SOURCE_CONTINUE;
+}
+
+static void count_changes(GMenuModel *model, int position, int removed, int added, uint *changes)
+{
+	(*changes)++;
+}
+
+typedef struct
+{
+	FakeServer *server;
+	GDBusConnection *connection;
+	DBusMenuXml *xml;
+	DBusMenuActionGroup *actions;
+	DBusMenuModel *submenu;
+	GMenuModel *section;
+	uint changes;
+	uint ticks;
+} Fixture;
+
+static void fixture_set_up(Fixture *fixture, gconstpointer data)
+{
+	g_autoptr(GError) error = NULL;
+	fixture->server         = fake_server_new(MENU_PATH, menubar_layout());
+	fixture->connection     = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+	g_assert_no_error(error);
+	fixture->xml = dbus_menu_xml_proxy_new_sync(fixture->connection,
+	                                            G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+	                                                G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+	                                            fake_server_get_name(fixture->server),
+	                                            MENU_PATH,
+	                                            NULL,
+	                                            &error);
+	g_assert_no_error(error);
+	fixture->actions = dbus_menu_action_group_new();
+	fixture->submenu =
+	    dbus_menu_model_new(FILE_ID, NULL, fixture->xml, G_ACTION_GROUP(fixture->actions));
+	// Root model reports only changes of section count, items are reported by sections
+	fixture->section =
+	    g_menu_model_get_item_link(G_MENU_MODEL(fixture->submenu), 0, G_MENU_LINK_SECTION);
+	g_signal_connect(fixture->section,
+	                 "items-changed",
+	                 G_CALLBACK(count_changes),
+	                 &fixture->changes);
+}
+
+static void fixture_tear_down(Fixture *fixture, gconstpointer data)
+{
+	g_signal_handlers_disconnect_by_data(fixture->section, &fixture->changes);
+	g_clear_object(&fixture->section);
+	g_clear_object(&fixture->submenu);
+	g_clear_object(&fixture->actions);
+	g_clear_object(&fixture->xml);
+	g_clear_object(&fixture->connection);
+	fake_server_free(fixture->server);
+}
+
+// Opens the submenu and runs the main loop until it is populated. Returns elapsed time.
+static double open_and_wait(Fixture *fixture)
+{
+	uint ticker    = g_timeout_add(TICK_MS, (GSourceFunc)tick, &fixture->ticks);
+	gint64 start   = g_get_monotonic_time();
+	dbus_menu_model_open(fixture->submenu);
+	double call_ms = test_elapsed_ms(start);
+	g_assert_cmpfloat(call_ms, <, SLOW_REPLY_MS / 5);
+	while (dbus_menu_model_get_section_n_items(fixture->submenu, 0) == 0 &&
+	       test_elapsed_ms(start) < DEADLINE_MS)
+		g_main_context_iteration(NULL, true);
+	g_source_remove(ticker);
+	g_assert_cmpuint(dbus_menu_model_get_section_n_items(fixture->submenu, 0), ==, FILE_ITEMS);
+	g_assert_cmpuint(fixture->changes, >, 0);
+	return test_elapsed_ms(start);
+}
+
+static void test_open_slow_server(Fixture *fixture, gconstpointer data)
+{
+	fake_server_set_delay(fixture->server, "AboutToShow", SLOW_REPLY_MS);
+	fake_server_set_delay(fixture->server, "GetLayout", SLOW_REPLY_MS);
+	double elapsed = open_and_wait(fixture);
+	g_print("populated after %.1f ms, %u ticks\n", elapsed, fixture->ticks);
+	g_assert_cmpfloat(elapsed, >=, 2 * SLOW_REPLY_MS);
+	// A blocked loop would dispatch the ticker once or twice in the whole wait
+	g_assert_cmpuint(fixture->ticks, >=, SLOW_REPLY_MS / TICK_MS);
+	g_assert_cmpuint(fake_server_get_calls(fixture->server, "AboutToShow"), ==, 1);
+	g_assert_cmpuint(fake_server_get_calls(fixture->server, "GetLayout"), ==, 1);
+}
+
+static void test_open_hung_server(Fixture *fixture, gconstpointer data)
+{
+	fake_server_set_delay(fixture->server, "AboutToShow", HUNG_REPLY_MS);
+	dbus_menu_model_set_timeout(fixture->submenu, MODEL_TIMEOUT_MS);
+	double elapsed = open_and_wait(fixture);
+	g_print("populated after %.1f ms, %u ticks\n", elapsed, fixture->ticks);
+	// Layout is requested anyway once AboutToShow times out
+	g_assert_cmpfloat(elapsed, >=, MODEL_TIMEOUT_MS);
+	g_assert_cmpfloat(elapsed, <, HUNG_REPLY_MS);
+	g_assert_cmpuint(fixture->ticks, >=, MODEL_TIMEOUT_MS / TICK_MS / 2);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_autoptr(GTestDBus) bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(bus);
+	g_test_add("/open/slow-server",
+	           Fixture,
+	           NULL,
+	           fixture_set_up,
+	           test_open_slow_server,
+	           fixture_tear_down);
+	g_test_add("/open/hung-server",
+	           Fixture,
+	           NULL,
+	           fixture_set_up,
+	           test_open_hung_server,
+	           fixture_tear_down);
+	int ret = g_test_run();
+	g_test_dbus_down(bus);
+	return ret;
+}
@@ -0,0 +1,128 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* D-Bus messages of a window switch. A panel builds a new importer on every switch, and the
+ * second importer of the same menu reuses the pooled proxy and the cached layout, so it
+ * must cost fewer messages than the first one. It must still notify about its model after
+ * construction, which is when the panel starts listening.
+ */
+
+#include "common.h"
+#include "fake-server.h"
+#include "importer.h"
+
+#define MENU_PATH "/MenuBar"
+#define SETTLE_MS 300
+#define DEADLINE_MS 5000
+
+static int messages = 0;
+
+// Runs in the GDBus worker thread
+static GDBusMessage *count_message(GDBusConnection *connection, GDBusMessage *message,
+                                   gboolean incoming, gpointer user_data)
+{
+	g_atomic_int_inc(&messages);
+	return message;
+}
+
+static void count_notify(GObject *object, GParamSpec *pspec, uint *notifies)
+{
+	(*notifies)++;
+}
+
+typedef struct
+{
+	uint messages;
+	uint notifies;
+	double elapsed;
+} WindowSwitch;
+
+/* Builds an importer the way lib/helper-dbusmenu.vala does and runs the main loop until
+ * it has notified about its model and no message was seen for SETTLE_MS.
+ */
+static DBusMenuImporter *switch_to(FakeServer *server, WindowSwitch *result)
+{
+	g_atomic_int_set(&messages, 0);
+	gint64 start = g_get_monotonic_time();
+	DBusMenuImporter *importer =
+	    dbus_menu_importer_new(fake_server_get_name(server), MENU_PATH);
+	g_signal_connect(importer, "notify::model", G_CALLBACK(count_notify), &result->notifies);
+	gint64 last_message = start;
+	int seen            = 0;
+	while ((result->notifies == 0 || test_elapsed_ms(last_message) < SETTLE_MS) &&
+	       test_elapsed_ms(start) < DEADLINE_MS)
+	{
+		g_main_context_iteration(NULL, false);
+		g_usleep(1000);
+		if (g_atomic_int_get(&messages) == seen)
+			continue;
+		seen         = g_atomic_int_get(&messages);
+		last_message = g_get_monotonic_time();
+	}
+	result->messages = seen;
+	result->elapsed  = test_elapsed_ms(start) - SETTLE_MS;
+	return importer;
+}
+
+static void test_pool_window_switch(gconstpointer data)
+{
+	g_autoptr(GError) error    = NULL;
+	g_autoptr(GVariant) layout = test_layout_load((const char *)data, NULL, NULL);
+	FakeServer *server         = fake_server_new(MENU_PATH, g_variant_ref(layout));
+	// Importers use the shared session connection
+	g_autoptr(GDBusConnection) connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+	g_assert_no_error(error);
+	uint filter = g_dbus_connection_add_filter(connection, count_message, NULL, NULL);
+
+	WindowSwitch first = { 0 }, second = { 0 };
+	DBusMenuImporter *importer = switch_to(server, &first);
+	g_object_unref(importer);
+	importer = switch_to(server, &second);
+	g_print("first switch: %u messages, %.1f ms\n", first.messages, first.elapsed);
+	g_print("second switch: %u messages, %.1f ms\n", second.messages, second.elapsed);
+	g_assert_cmpuint(first.notifies, >, 0);
+	g_assert_cmpuint(second.notifies, >, 0);
+	g_assert_cmpuint(second.messages, <, first.messages);
+
+	g_autoptr(GMenuModel) model = NULL;
+	g_object_get(importer, "model", &model, NULL);
+	g_autoptr(GMenuModel) section = g_menu_model_get_item_link(model, 0, G_MENU_LINK_SECTION);
+	g_autoptr(GVariant) root      = g_variant_get_child_value(layout, 2);
+	g_assert_cmpint(g_menu_model_get_n_items(section), ==, g_variant_n_children(root));
+
+	g_object_unref(importer);
+	g_dbus_connection_remove_filter(connection, filter);
+	fake_server_free(server);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	if (argc < 2)
+	{
+		g_printerr("Usage: %s LAYOUT\n", argv[0]);
+		return 1;
+	}
+	g_autoptr(GTestDBus) bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(bus);
+	g_test_add_data_func("/pool/window-switch", argv[1], test_pool_window_switch);
+	int ret = g_test_run();
+	// Pooled proxies outlive importers for a while, and they hold the session connection
+	g_test_dbus_stop(bus);
+	return ret;
+}
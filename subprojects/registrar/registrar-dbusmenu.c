@@ -22,33 +22,53 @@
 
 extern const char *introspection_xml;
 
+/* Removed windows are remembered for incremental GetMenusSince replies. Older removals are
+ * forgotten, and clients which are too far behind receive a full list instead.
+ */
+#define REGISTRAR_TOMBSTONES_MAX 256
+// Changes are collected for this time, in milliseconds, before windows-changed is emitted
+#define REGISTRAR_BATCH_INTERVAL 50
+// Snapshot of registered windows is written after this time without changes, in seconds
+#define REGISTRAR_SNAPSHOT_INTERVAL 2
+#define REGISTRAR_SNAPSHOT_VERSION 2
+#define REGISTRAR_SNAPSHOT_FILE "appmenu-registrar-%s.snapshot"
+
+// Names and paths are interned GRefStrings: windows of one client share them
 typedef struct
 {
 	char *bus_name;
 	char *object_path;
+	uint serial;
 } DBusAddress;
 
+typedef struct
+{
+	uint window_id;
+	uint serial;
+} Tombstone;
+
 DBusAddress *dbus_address_new(const char *bus_name, const char *object_path)
 {
 	DBusAddress *ret = (DBusAddress *)g_slice_alloc0(sizeof(DBusAddress));
-	ret->bus_name    = g_strdup(bus_name);
-	ret->object_path = g_strdup(object_path);
+	ret->bus_name    = g_ref_string_new_intern(bus_name);
+	ret->object_path = g_ref_string_new_intern(object_path);
 	return ret;
 }
 
 DBusAddress *dbus_address_copy(const DBusAddress *src)
 {
 	DBusAddress *ret = (DBusAddress *)g_slice_new(DBusAddress);
-	ret->bus_name    = g_strdup(src->bus_name);
-	ret->object_path = g_strdup(src->object_path);
+	ret->bus_name    = g_ref_string_acquire(src->bus_name);
+	ret->object_path = g_ref_string_acquire(src->object_path);
+	ret->serial      = src->serial;
 	return ret;
 }
 
 void dbus_address_free(void *obj)
 {
 	DBusAddress *addr = (DBusAddress *)obj;
-	g_free(addr->bus_name);
-	g_free(addr->object_path);
+	g_ref_string_release(addr->bus_name);
+	g_ref_string_release(addr->object_path);
 	g_slice_free1(sizeof(DBusAddress), addr);
 }
 
@@ -58,7 +78,17 @@ struct _RegistrarDBusMenu
 {
 	GObject parent;
 	GHashTable *menus;
+	GHashTable *senders;
+	GQueue tombstones;
+	uint generation;
+	uint serial;
+	uint tombstone_floor;
+	GHashTable *batch;
+	uint batch_source;
+	uint snapshot_source;
+	char *bus_guid;
 	uint registered_object;
+	uint name_owner_changed;
 };
 
 G_DEFINE_TYPE(RegistrarDBusMenu, registrar_dbus_menu, G_TYPE_OBJECT)
@@ -67,17 +97,136 @@ enum
 {
 	WINDOW_REGISTERED_SIGNAL,
 	WINDOW_UNREGISTERED_SIGNAL,
+	WINDOWS_CHANGED_SIGNAL,
 	NUM_SIGNALS
 };
 static uint registrar_dbus_menu_signals[NUM_SIGNALS] = { 0 };
 
+static void registrar_dbus_menu_schedule_snapshot(RegistrarDBusMenu *self);
+
+static bool dbus_address_equal(const DBusAddress *a, const DBusAddress *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	// Strings are interned
+	return a->bus_name == b->bus_name && a->object_path == b->object_path;
+}
+
+static void dbus_address_free_nullable(void *obj)
+{
+	if (obj != NULL)
+		dbus_address_free(obj);
+}
+
+/* Batch keeps the address every touched window had before the batch started. On flush it
+ * is compared with the current one, so a window registered and unregistered again, or
+ * registered twice with the same menu, is not reported at all.
+ */
+static bool registrar_dbus_menu_batch_flush(RegistrarDBusMenu *self)
+{
+	GVariantBuilder registered, unregistered;
+	GHashTableIter iter;
+	gpointer key, value;
+	bool changed       = false;
+	self->batch_source = 0;
+
+	g_variant_builder_init(&registered, G_VARIANT_TYPE("a(uso)"));
+	g_variant_builder_init(&unregistered, G_VARIANT_TYPE("au"));
+	g_hash_table_iter_init(&iter, self->batch);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+	{
+		DBusAddress *current = (DBusAddress *)g_hash_table_lookup(self->menus, key);
+		if (dbus_address_equal(current, (DBusAddress *)value))
+			continue;
+		changed = true;
+		if (current != NULL)
+			g_variant_builder_add(&registered,
+			                      "(uso)",
+			                      GPOINTER_TO_UINT(key),
+			                      current->bus_name,
+			                      current->object_path);
+		else
+			g_variant_builder_add(&unregistered, "u", GPOINTER_TO_UINT(key));
+	}
+	g_hash_table_remove_all(self->batch);
+	g_autoptr(GVariant) registered_v   = g_variant_builder_end(&registered);
+	g_autoptr(GVariant) unregistered_v = g_variant_builder_end(&unregistered);
+	g_variant_ref_sink(registered_v);
+	g_variant_ref_sink(unregistered_v);
+	if (!changed)
+		return G_SOURCE_REMOVE;
+	g_signal_emit(self,
+	              registrar_dbus_menu_signals[WINDOWS_CHANGED_SIGNAL],
+	              0,
+	              registered_v,
+	              unregistered_v);
+	registrar_dbus_menu_schedule_snapshot(self);
+	return G_SOURCE_REMOVE;
+}
+
+static void registrar_dbus_menu_batch_touch(RegistrarDBusMenu *self, uint window_id)
+{
+	if (!g_hash_table_contains(self->batch, GUINT_TO_POINTER(window_id)))
+	{
+		DBusAddress *addr =
+		    (DBusAddress *)g_hash_table_lookup(self->menus, GUINT_TO_POINTER(window_id));
+		g_hash_table_insert(self->batch,
+		                    GUINT_TO_POINTER(window_id),
+		                    addr != NULL ? dbus_address_copy(addr) : NULL);
+	}
+	if (!self->batch_source)
+		self->batch_source = g_timeout_add(REGISTRAR_BATCH_INTERVAL,
+		                                   (GSourceFunc)registrar_dbus_menu_batch_flush,
+		                                   self);
+}
+
+// Every sender has a set of its windows, so all of them are dropped when it quits
+static void registrar_dbus_menu_forget_window(RegistrarDBusMenu *self, uint window_id)
+{
+	DBusAddress *addr =
+	    (DBusAddress *)g_hash_table_lookup(self->menus, GUINT_TO_POINTER(window_id));
+	if (addr == NULL)
+		return;
+	GHashTable *windows = (GHashTable *)g_hash_table_lookup(self->senders, addr->bus_name);
+	if (windows == NULL)
+		return;
+	g_hash_table_remove(windows, GUINT_TO_POINTER(window_id));
+	if (g_hash_table_size(windows) == 0)
+		g_hash_table_remove(self->senders, addr->bus_name);
+}
+
+static void registrar_dbus_menu_bury_window(RegistrarDBusMenu *self, uint window_id)
+{
+	Tombstone *tombstone = g_slice_new(Tombstone);
+	tombstone->window_id = window_id;
+	tombstone->serial    = ++self->serial;
+	g_queue_push_tail(&self->tombstones, tombstone);
+	if (g_queue_get_length(&self->tombstones) <= REGISTRAR_TOMBSTONES_MAX)
+		return;
+	Tombstone *oldest     = (Tombstone *)g_queue_pop_head(&self->tombstones);
+	self->tombstone_floor = oldest->serial;
+	g_slice_free(Tombstone, oldest);
+}
+
 void registrar_dbus_menu_register_window(RegistrarDBusMenu *self, uint window_id,
                                          const char *menu_object_path, const char *sender)
 {
 	g_return_if_fail(self != NULL);
 	g_return_if_fail(menu_object_path != NULL);
 	g_return_if_fail(sender != NULL);
+	// Same menu may be registered again to make panels reload it, so WindowRegistered is
+	// always emitted. Only the windows-changed batch collapses such duplicates.
 	DBusAddress *addr = dbus_address_new(sender, menu_object_path);
+	registrar_dbus_menu_batch_touch(self, window_id);
+	registrar_dbus_menu_forget_window(self, window_id);
+	GHashTable *windows = (GHashTable *)g_hash_table_lookup(self->senders, sender);
+	if (windows == NULL)
+	{
+		windows = g_hash_table_new(g_direct_hash, g_direct_equal);
+		g_hash_table_insert(self->senders, g_ref_string_acquire(addr->bus_name), windows);
+	}
+	g_hash_table_add(windows, GUINT_TO_POINTER(window_id));
+	addr->serial = ++self->serial;
 	g_hash_table_insert(self->menus, GUINT_TO_POINTER(window_id), addr);
 	g_signal_emit(self,
 	              registrar_dbus_menu_signals[WINDOW_REGISTERED_SIGNAL],
@@ -90,10 +239,50 @@ void registrar_dbus_menu_register_window(RegistrarDBusMenu *self, uint window_id
 void registrar_dbus_menu_unregister_window(RegistrarDBusMenu *self, uint window_id)
 {
 	g_return_if_fail(self != NULL);
-	g_hash_table_remove(self->menus, GUINT_TO_POINTER(window_id));
+	registrar_dbus_menu_batch_touch(self, window_id);
+	registrar_dbus_menu_forget_window(self, window_id);
+	if (g_hash_table_remove(self->menus, GUINT_TO_POINTER(window_id)))
+		registrar_dbus_menu_bury_window(self, window_id);
 	g_signal_emit(self, registrar_dbus_menu_signals[WINDOW_UNREGISTERED_SIGNAL], 0, window_id);
 }
 
+/* Applications which crashed or were killed never unregister their windows, so windows are
+ * dropped when the unique name of their sender vanishes from the bus.
+ */
+static void registrar_dbus_menu_name_owner_changed(GDBusConnection *connection,
+                                                   const char *sender_name,
+                                                   const char *object_path,
+                                                   const char *interface_name,
+                                                   const char *signal_name, GVariant *parameters,
+                                                   gpointer user_data)
+{
+	RegistrarDBusMenu *self = REGISTRAR_DBUS_MENU(user_data);
+	const char *name, *old_owner, *new_owner;
+	g_variant_get(parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+	if (*new_owner != '\0' || !g_dbus_is_unique_name(name))
+		return;
+	gpointer sender, windows;
+	if (!g_hash_table_lookup_extended(self->senders, name, &sender, &windows))
+		return;
+	g_hash_table_steal(self->senders, name);
+	g_debug("%s vanished, dropping %u windows", name, g_hash_table_size(windows));
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init(&iter, (GHashTable *)windows);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+	{
+		registrar_dbus_menu_batch_touch(self, GPOINTER_TO_UINT(key));
+		g_hash_table_remove(self->menus, key);
+		registrar_dbus_menu_bury_window(self, GPOINTER_TO_UINT(key));
+		g_signal_emit(self,
+		              registrar_dbus_menu_signals[WINDOW_UNREGISTERED_SIGNAL],
+		              0,
+		              GPOINTER_TO_UINT(key));
+	}
+	g_ref_string_release(sender);
+	g_hash_table_unref((GHashTable *)windows);
+}
+
 void registrar_dbus_menu_get_menu_for_window(RegistrarDBusMenu *self, uint window_id,
                                              char **service, char **object_path)
 {
@@ -135,15 +324,252 @@ void registrar_dbus_menu_get_menus(RegistrarDBusMenu *self, GVariant **menus)
 	*menus = g_variant_builder_end(&bldr);
 }
 
+/* Windows are kept in $XDG_RUNTIME_DIR, so a restarted registrar knows menus of clients
+ * which register only once, when their windows are created. Unique names mean something
+ * only on their own bus, and one user may run several session buses, so every bus has its
+ * own file. Snapshot is (usa(uso)): format version, GUID of the bus and the same entries
+ * as GetMenus returns, in GVariant normal form.
+ */
+static char *registrar_dbus_menu_snapshot_path(RegistrarDBusMenu *self)
+{
+	g_autofree char *name = g_strdup_printf(REGISTRAR_SNAPSHOT_FILE, self->bus_guid);
+	return g_build_filename(g_get_user_runtime_dir(), name, NULL);
+}
+
+static void registrar_dbus_menu_write_snapshot(RegistrarDBusMenu *self)
+{
+	if (self->bus_guid == NULL)
+		return;
+	g_autoptr(GError) error = NULL;
+	g_autofree char *path   = registrar_dbus_menu_snapshot_path(self);
+	GVariant *menus         = NULL;
+	registrar_dbus_menu_get_menus(self, &menus);
+	g_autoptr(GVariant) snapshot = g_variant_ref_sink(g_variant_new("(us@a(uso))",
+	                                                                REGISTRAR_SNAPSHOT_VERSION,
+	                                                                self->bus_guid,
+	                                                                menus));
+	g_autoptr(GVariant) normal = g_variant_get_normal_form(snapshot);
+	if (!g_file_set_contents(path,
+	                         g_variant_get_data(normal),
+	                         g_variant_get_size(normal),
+	                         &error))
+		g_debug("Cannot write snapshot: %s", error->message);
+}
+
+static bool registrar_dbus_menu_snapshot_timeout(RegistrarDBusMenu *self)
+{
+	self->snapshot_source = 0;
+	registrar_dbus_menu_write_snapshot(self);
+	return G_SOURCE_REMOVE;
+}
+
+static void registrar_dbus_menu_schedule_snapshot(RegistrarDBusMenu *self)
+{
+	if (self->snapshot_source > 0)
+		g_source_remove(self->snapshot_source);
+	self->snapshot_source =
+	    g_timeout_add_seconds(REGISTRAR_SNAPSHOT_INTERVAL,
+	                          (GSourceFunc)registrar_dbus_menu_snapshot_timeout,
+	                          self);
+}
+
+typedef struct
+{
+	RegistrarDBusMenu *self;
+	uint window_id;
+	char *service;
+	char *path;
+} RestoredWindow;
+
+static void restored_window_free(RestoredWindow *restored)
+{
+	g_object_unref(restored->self);
+	g_free(restored->service);
+	g_free(restored->path);
+	g_slice_free(RestoredWindow, restored);
+}
+
+static void restored_window_owner_cb(GObject *source_object, GAsyncResult *res,
+                                     gpointer user_data)
+{
+	RestoredWindow *restored = (RestoredWindow *)user_data;
+	g_autoptr(GError) error  = NULL;
+	g_autoptr(GVariant) ret =
+	    g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+	RegistrarDBusMenu *self = restored->self;
+	// Client is gone, or window was registered again while owner was checked
+	if (ret == NULL ||
+	    g_hash_table_contains(self->menus, GUINT_TO_POINTER(restored->window_id)))
+	{
+		restored_window_free(restored);
+		return;
+	}
+	g_debug("Restored window %u of %s", restored->window_id, restored->service);
+	registrar_dbus_menu_register_window(self,
+	                                    restored->window_id,
+	                                    restored->path,
+	                                    restored->service);
+	restored_window_free(restored);
+}
+
+/* Entries come back only from a snapshot of the same bus, and only when their unique name
+ * still has an owner. Unique names are not reused during a bus session, so such owner is
+ * the same client.
+ */
+static void registrar_dbus_menu_restore_snapshot(RegistrarDBusMenu *self,
+                                                 GDBusConnection *connection)
+{
+	g_free(self->bus_guid);
+	self->bus_guid        = g_strdup(g_dbus_connection_get_guid(connection));
+	g_autofree char *path = registrar_dbus_menu_snapshot_path(self);
+	g_autoptr(GMappedFile) file = g_mapped_file_new(path, false, NULL);
+	if (file == NULL)
+		return;
+	g_autoptr(GBytes) bytes = g_mapped_file_get_bytes(file);
+	// Data is not trusted, so GVariant checks it on access
+	g_autoptr(GVariant) snapshot = g_variant_ref_sink(
+	    g_variant_new_from_bytes(G_VARIANT_TYPE("(usa(uso))"), bytes, false));
+	uint version;
+	const char *bus_guid;
+	g_autoptr(GVariant) menus = NULL;
+	g_variant_get(snapshot, "(u&s@a(uso))", &version, &bus_guid, &menus);
+	if (version != REGISTRAR_SNAPSHOT_VERSION || g_strcmp0(bus_guid, self->bus_guid))
+		return;
+	GVariantIter iter;
+	uint window_id;
+	const char *service, *object_path;
+	g_variant_iter_init(&iter, menus);
+	while (g_variant_iter_next(&iter, "(u&s&o)", &window_id, &service, &object_path))
+	{
+		if (!g_dbus_is_unique_name(service))
+			continue;
+		RestoredWindow *restored = g_slice_new0(RestoredWindow);
+		restored->self           = g_object_ref(self);
+		restored->window_id      = window_id;
+		restored->service        = g_strdup(service);
+		restored->path           = g_strdup(object_path);
+		g_dbus_connection_call(connection,
+		                       "org.freedesktop.DBus",
+		                       "/org/freedesktop/DBus",
+		                       "org.freedesktop.DBus",
+		                       "GetNameOwner",
+		                       g_variant_new("(s)", service),
+		                       G_VARIANT_TYPE("(s)"),
+		                       G_DBUS_CALL_FLAGS_NONE,
+		                       -1,
+		                       NULL,
+		                       restored_window_owner_cb,
+		                       restored);
+	}
+}
+
+GVariant *registrar_dbus_menu_get_menus_for_windows(RegistrarDBusMenu *self, GVariant *windows)
+{
+	GVariantBuilder bldr;
+	gsize n_windows;
+	const guint32 *ids = g_variant_get_fixed_array(windows, &n_windows, sizeof(guint32));
+
+	g_variant_builder_init(&bldr, G_VARIANT_TYPE("a(uso)"));
+	for (gsize i = 0; i < n_windows; i++)
+	{
+		DBusAddress *addr =
+		    (DBusAddress *)g_hash_table_lookup(self->menus, GUINT_TO_POINTER(ids[i]));
+		if (addr != NULL)
+			g_variant_builder_add(&bldr,
+			                      "(uso)",
+			                      ids[i],
+			                      addr->bus_name,
+			                      addr->object_path);
+	}
+	return g_variant_builder_end(&bldr);
+}
+
+/* Returns (generation, current serial, full, changed menus, removed windows). Serials are
+ * counted anew by every registrar instance, so they are compared only within the same
+ * generation. Serial 0, a serial of another generation, or one older than remembered
+ * removals gives a full list, which replaces everything the client knows.
+ */
+GVariant *registrar_dbus_menu_get_menus_since(RegistrarDBusMenu *self, uint generation,
+                                              uint serial)
+{
+	GVariantBuilder menus, removed;
+	GHashTableIter iter;
+	gpointer key, value;
+	bool full = generation != self->generation || serial == 0 || serial > self->serial ||
+	            serial < self->tombstone_floor;
+
+	g_variant_builder_init(&menus, G_VARIANT_TYPE("a(uso)"));
+	g_variant_builder_init(&removed, G_VARIANT_TYPE("au"));
+	g_hash_table_iter_init(&iter, self->menus);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+	{
+		DBusAddress *addr = (DBusAddress *)value;
+		if (full || addr->serial > serial)
+			g_variant_builder_add(&menus,
+			                      "(uso)",
+			                      GPOINTER_TO_UINT(key),
+			                      addr->bus_name,
+			                      addr->object_path);
+	}
+	for (GList *l = full ? NULL : self->tombstones.tail; l != NULL; l = l->prev)
+	{
+		Tombstone *tombstone = (Tombstone *)l->data;
+		if (tombstone->serial <= serial)
+			break;
+		// Window registered again is reported as changed
+		if (!g_hash_table_contains(self->menus, GUINT_TO_POINTER(tombstone->window_id)))
+			g_variant_builder_add(&removed, "u", tombstone->window_id);
+	}
+	return g_variant_new("(uub@a(uso)@au)",
+	                     self->generation,
+	                     self->serial,
+	                     full,
+	                     g_variant_builder_end(&menus),
+	                     g_variant_builder_end(&removed));
+}
+
+static void tombstone_free(gpointer data)
+{
+	g_slice_free(Tombstone, data);
+}
+
 static void registrar_dbus_menu_init(RegistrarDBusMenu *self)
 {
 	self->menus = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dbus_address_free);
+
+	self->senders = g_hash_table_new_full(g_str_hash,
+	                                      g_str_equal,
+	                                      (GDestroyNotify)g_ref_string_release,
+	                                      (GDestroyNotify)g_hash_table_unref);
+	self->batch = g_hash_table_new_full(g_direct_hash,
+	                                    g_direct_equal,
+	                                    NULL,
+	                                    dbus_address_free_nullable);
+	self->batch_source    = 0;
+	self->snapshot_source = 0;
+	self->bus_guid        = NULL;
+	g_queue_init(&self->tombstones);
+	self->generation      = (uint)g_random_int_range(1, G_MAXINT32);
+	self->serial          = 0;
+	self->tombstone_floor = 0;
 }
 
 static void registrar_dbus_menu_finalize(GObject *obj)
 {
 	RegistrarDBusMenu *self = REGISTRAR_DBUS_MENU(obj);
+	// Changes which are not saved yet must survive the exit
+	if (self->snapshot_source > 0 || self->batch_source > 0)
+		registrar_dbus_menu_write_snapshot(self);
 	g_hash_table_unref(self->menus);
+	g_hash_table_unref(self->senders);
+	if (self->batch_source > 0)
+		g_source_remove(self->batch_source);
+	g_hash_table_unref(self->batch);
+	if (self->snapshot_source > 0)
+		g_source_remove(self->snapshot_source);
+	g_free(self->bus_guid);
+	g_queue_foreach(&self->tombstones, (GFunc)tombstone_free, NULL);
+	g_queue_clear(&self->tombstones);
 	G_OBJECT_CLASS(registrar_dbus_menu_parent_class)->finalize(obj);
 }
 
@@ -174,128 +600,86 @@ static void registrar_dbus_menu_class_init(RegistrarDBusMenuClass *klass)
 	                 G_TYPE_NONE,
 	                 1,
 	                 G_TYPE_UINT);
+	// Batched registrations (a(uso)) and unregistrations (au)
+	registrar_dbus_menu_signals[WINDOWS_CHANGED_SIGNAL] =
+	    g_signal_new(g_intern_static_string("windows-changed"),
+	                 registrar_dbus_menu_get_type(),
+	                 G_SIGNAL_RUN_LAST,
+	                 0,
+	                 NULL,
+	                 NULL,
+	                 g_cclosure_user_marshal_VOID__VARIANT_VARIANT,
+	                 G_TYPE_NONE,
+	                 2,
+	                 G_TYPE_VARIANT,
+	                 G_TYPE_VARIANT);
 }
 
 static void _dbus_registrar_dbus_menu_register_window(RegistrarDBusMenu *self,
                                                       GVariant *_parameters_,
                                                       GDBusMethodInvocation *invocation)
 {
-	g_autoptr(GError) error = NULL;
-	GVariantIter _arguments_iter;
-	uint window_id               = 0U;
-	char *menu_object_path       = NULL;
-	GDBusMessage *_reply_message = NULL;
-	GVariant *_reply;
-	GVariantBuilder _reply_builder;
-	g_variant_iter_init(&_arguments_iter, _parameters_);
-	GVariant *value = g_variant_iter_next_value(&_arguments_iter);
-	window_id       = g_variant_get_uint32(value);
-	g_variant_unref(value);
-	value            = g_variant_iter_next_value(&_arguments_iter);
-	menu_object_path = g_variant_dup_string(value, NULL);
-	g_variant_unref(value);
+	uint window_id;
+	const char *menu_object_path;
+	g_variant_get(_parameters_, "(u&o)", &window_id, &menu_object_path);
 	registrar_dbus_menu_register_window(self,
 	                                    window_id,
 	                                    menu_object_path,
 	                                    g_dbus_method_invocation_get_sender(invocation));
-	_reply_message =
-	    g_dbus_message_new_method_reply(g_dbus_method_invocation_get_message(invocation));
-	g_variant_builder_init(&_reply_builder, G_VARIANT_TYPE_TUPLE);
-	_reply = g_variant_builder_end(&_reply_builder);
-	g_dbus_message_set_body(_reply_message, _reply);
-	g_dbus_connection_send_message(g_dbus_method_invocation_get_connection(invocation),
-	                               _reply_message,
-	                               G_DBUS_SEND_MESSAGE_FLAGS_NONE,
-	                               NULL,
-	                               NULL);
-	g_object_unref(invocation);
-	g_object_unref(_reply_message);
-	g_free(menu_object_path);
+	g_dbus_method_invocation_return_value(invocation, NULL);
 }
 
 static void _dbus_registrar_dbus_menu_unregister_window(RegistrarDBusMenu *self,
                                                         GVariant *_parameters_,
                                                         GDBusMethodInvocation *invocation)
 {
-	g_autoptr(GError) error = NULL;
-	GVariantIter _arguments_iter;
-	uint window_id               = 0U;
-	GDBusMessage *_reply_message = NULL;
-	GVariant *_reply;
-	GVariantBuilder _reply_builder;
-	g_variant_iter_init(&_arguments_iter, _parameters_);
-	GVariant *value = g_variant_iter_next_value(&_arguments_iter);
-	window_id       = g_variant_get_uint32(value);
-	g_variant_unref(value);
+	uint window_id;
+	g_variant_get(_parameters_, "(u)", &window_id);
 	registrar_dbus_menu_unregister_window(self, window_id);
-	_reply_message =
-	    g_dbus_message_new_method_reply(g_dbus_method_invocation_get_message(invocation));
-	g_variant_builder_init(&_reply_builder, G_VARIANT_TYPE_TUPLE);
-	_reply = g_variant_builder_end(&_reply_builder);
-	g_dbus_message_set_body(_reply_message, _reply);
-	g_dbus_connection_send_message(g_dbus_method_invocation_get_connection(invocation),
-	                               _reply_message,
-	                               G_DBUS_SEND_MESSAGE_FLAGS_NONE,
-	                               NULL,
-	                               NULL);
-	g_object_unref(invocation);
-	g_object_unref(_reply_message);
+	g_dbus_method_invocation_return_value(invocation, NULL);
 }
 
 static void _dbus_registrar_dbus_menu_get_menu_for_window(RegistrarDBusMenu *self,
                                                           GVariant *_parameters_,
                                                           GDBusMethodInvocation *invocation)
 {
-	GVariantIter _arguments_iter;
-	uint window                  = 0U;
-	GDBusMessage *_reply_message = NULL;
-	GVariant *_reply;
-	GVariantBuilder _reply_builder;
+	uint window;
 	char *service = NULL;
 	char *path    = NULL;
-	g_variant_iter_init(&_arguments_iter, _parameters_);
-	g_autoptr(GVariant) value = g_variant_iter_next_value(&_arguments_iter);
-	window                    = g_variant_get_uint32(value);
+	g_variant_get(_parameters_, "(u)", &window);
 	registrar_dbus_menu_get_menu_for_window(self, window, &service, &path);
-	_reply_message =
-	    g_dbus_message_new_method_reply(g_dbus_method_invocation_get_message(invocation));
-	g_variant_builder_init(&_reply_builder, G_VARIANT_TYPE_TUPLE);
-	g_variant_builder_add_value(&_reply_builder, g_variant_new_string(service));
-	g_variant_builder_add_value(&_reply_builder, g_variant_new_object_path(path));
-	_reply = g_variant_builder_end(&_reply_builder);
-	g_dbus_message_set_body(_reply_message, _reply);
-	g_dbus_connection_send_message(g_dbus_method_invocation_get_connection(invocation),
-	                               _reply_message,
-	                               G_DBUS_SEND_MESSAGE_FLAGS_NONE,
-	                               NULL,
-	                               NULL);
-	g_object_unref(invocation);
-	g_object_unref(_reply_message);
+	g_dbus_method_invocation_return_value(invocation, g_variant_new("(so)", service, path));
 }
 
 static void _dbus_registrar_dbus_menu_get_menus(RegistrarDBusMenu *self, GVariant *_parameters_,
                                                 GDBusMethodInvocation *invocation)
 {
-	GVariantIter _arguments_iter;
-	GDBusMessage *_reply_message = NULL;
-	GVariant *_reply;
-	GVariantBuilder _reply_builder;
 	GVariant *menus = NULL;
-	g_variant_iter_init(&_arguments_iter, _parameters_);
 	registrar_dbus_menu_get_menus(self, &menus);
-	_reply_message =
-	    g_dbus_message_new_method_reply(g_dbus_method_invocation_get_message(invocation));
-	g_variant_builder_init(&_reply_builder, G_VARIANT_TYPE_TUPLE);
-	g_variant_builder_add_value(&_reply_builder, menus);
-	_reply = g_variant_builder_end(&_reply_builder);
-	g_dbus_message_set_body(_reply_message, _reply);
-	g_dbus_connection_send_message(g_dbus_method_invocation_get_connection(invocation),
-	                               _reply_message,
-	                               G_DBUS_SEND_MESSAGE_FLAGS_NONE,
-	                               NULL,
-	                               NULL);
-	g_object_unref(invocation);
-	g_object_unref(_reply_message);
+	g_dbus_method_invocation_return_value(invocation, g_variant_new_tuple(&menus, 1));
+}
+
+typedef void (*RegistrarDBusMenuMethod)(RegistrarDBusMenu *self, GVariant *_parameters_,
+                                        GDBusMethodInvocation *invocation);
+
+// Method names are quarks, so dispatch compares integers instead of strings
+static struct
+{
+	const char *name;
+	GQuark quark;
+	RegistrarDBusMenuMethod call;
+} registrar_dbus_menu_methods[] = {
+	{ "RegisterWindow", 0, _dbus_registrar_dbus_menu_register_window },
+	{ "UnregisterWindow", 0, _dbus_registrar_dbus_menu_unregister_window },
+	{ "GetMenuForWindow", 0, _dbus_registrar_dbus_menu_get_menu_for_window },
+	{ "GetMenus", 0, _dbus_registrar_dbus_menu_get_menus },
+};
+
+static void registrar_dbus_menu_methods_init(void)
+{
+	for (uint i = 0; i < G_N_ELEMENTS(registrar_dbus_menu_methods); i++)
+		registrar_dbus_menu_methods[i].quark =
+		    g_quark_from_static_string(registrar_dbus_menu_methods[i].name);
 }
 
 static void registrar_dbus_menu_dbus_interface_method_call(
@@ -304,26 +688,19 @@ static void registrar_dbus_menu_dbus_interface_method_call(
     GDBusMethodInvocation *invocation, gpointer user_data)
 {
 	RegistrarDBusMenu *object = REGISTRAR_DBUS_MENU(user_data);
-	if (g_strcmp0(method_name, "RegisterWindow") == 0)
-	{
-		_dbus_registrar_dbus_menu_register_window(object, parameters, invocation);
-	}
-	else if (g_strcmp0(method_name, "UnregisterWindow") == 0)
-	{
-		_dbus_registrar_dbus_menu_unregister_window(object, parameters, invocation);
-	}
-	else if (g_strcmp0(method_name, "GetMenuForWindow") == 0)
-	{
-		_dbus_registrar_dbus_menu_get_menu_for_window(object, parameters, invocation);
-	}
-	else if (g_strcmp0(method_name, "GetMenus") == 0)
-	{
-		_dbus_registrar_dbus_menu_get_menus(object, parameters, invocation);
-	}
-	else
+	GQuark method             = g_quark_try_string(method_name);
+	for (uint i = 0; method != 0 && i < G_N_ELEMENTS(registrar_dbus_menu_methods); i++)
 	{
-		g_object_unref(invocation);
+		if (registrar_dbus_menu_methods[i].quark != method)
+			continue;
+		registrar_dbus_menu_methods[i].call(object, parameters, invocation);
+		return;
 	}
+	g_dbus_method_invocation_return_error(invocation,
+	                                      G_DBUS_ERROR,
+	                                      G_DBUS_ERROR_UNKNOWN_METHOD,
+	                                      "Unknown method %s",
+	                                      method_name);
 }
 
 static void _dbus_registrar_dbus_menu_window_registered(GObject *_sender, uint window_id,
@@ -373,6 +750,9 @@ static const GDBusInterfaceVTable _interface_vtable = {
 void registrar_dbus_menu_unregister(RegistrarDBusMenu *data, GDBusConnection *con)
 {
 	g_dbus_connection_unregister_object(con, data->registered_object);
+	if (data->name_owner_changed > 0)
+		g_dbus_connection_signal_unsubscribe(con, data->name_owner_changed);
+	data->name_owner_changed = 0;
 	g_signal_handlers_disconnect_by_func(data,
 	                                     _dbus_registrar_dbus_menu_window_registered,
 	                                     con);
@@ -385,6 +765,7 @@ void registrar_dbus_menu_unregister(RegistrarDBusMenu *data, GDBusConnection *co
 uint registrar_dbus_menu_register(RegistrarDBusMenu *object, GDBusConnection *connection,
                                   GError **error)
 {
+	registrar_dbus_menu_methods_init();
 	GDBusNodeInfo *info = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
 	uint result         = g_dbus_connection_register_object(connection,
                                                         DBUSMENU_REG_OBJECT,
@@ -398,6 +779,18 @@ uint registrar_dbus_menu_register(RegistrarDBusMenu *object, GDBusConnection *co
 		return 0;
 	}
 	object->registered_object = result;
+	// One subscription serves all senders
+	object->name_owner_changed =
+	    g_dbus_connection_signal_subscribe(connection,
+	                                       "org.freedesktop.DBus",
+	                                       "org.freedesktop.DBus",
+	                                       "NameOwnerChanged",
+	                                       "/org/freedesktop/DBus",
+	                                       NULL,
+	                                       G_DBUS_SIGNAL_FLAGS_NONE,
+	                                       registrar_dbus_menu_name_owner_changed,
+	                                       object,
+	                                       NULL);
 	g_signal_connect(object,
 	                 "window-registered",
 	                 (GCallback)_dbus_registrar_dbus_menu_window_registered,
@@ -406,5 +799,6 @@ uint registrar_dbus_menu_register(RegistrarDBusMenu *object, GDBusConnection *co
 	                 "window-unregistered",
 	                 (GCallback)_dbus_registrar_dbus_menu_window_unregistered,
 	                 connection);
+	registrar_dbus_menu_restore_snapshot(object, connection);
 	return result;
 }
@@ -30,6 +30,9 @@ G_DECLARE_FINAL_TYPE(RegistrarDBusMenu, registrar_dbus_menu, REGISTRAR, DBUS_MEN
 uint registrar_dbus_menu_register(RegistrarDBusMenu *object, GDBusConnection *connection,
                                   GError **error);
 void registrar_dbus_menu_unregister(RegistrarDBusMenu *data, GDBusConnection *con);
+GVariant *registrar_dbus_menu_get_menus_for_windows(RegistrarDBusMenu *self, GVariant *windows);
+GVariant *registrar_dbus_menu_get_menus_since(RegistrarDBusMenu *self, uint generation,
+                                              uint serial);
 
 G_END_DECLS
 
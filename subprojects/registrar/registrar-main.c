@@ -114,24 +114,64 @@ static void registrar_application_method_call(GDBusConnection *connection, const
                                               const char *method_name, GVariant *parameters,
                                               GDBusMethodInvocation *invocation, gpointer user_data)
 {
-	GApplication *app = G_APPLICATION(user_data);
+	GApplication *app          = G_APPLICATION(user_data);
+	RegistrarApplication *self = REGISTRAR_APPLICATION(user_data);
 	if (g_strcmp0(method_name, "Reference") == 0)
 	{
 		g_application_hold(app);
+		g_dbus_method_invocation_return_value(invocation, NULL);
 	}
 	else if (g_strcmp0(method_name, "UnReference") == 0)
 	{
 		g_application_release(app);
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	}
+	else if (g_strcmp0(method_name, "GetMenusForWindows") == 0)
+	{
+		g_autoptr(GVariant) windows = g_variant_get_child_value(parameters, 0);
+		GVariant *menus =
+		    registrar_dbus_menu_get_menus_for_windows(self->registrar, windows);
+		g_dbus_method_invocation_return_value(invocation, g_variant_new_tuple(&menus, 1));
+	}
+	else if (g_strcmp0(method_name, "GetMenusSince") == 0)
+	{
+		uint generation, serial;
+		g_variant_get(parameters, "(uu)", &generation, &serial);
+		GVariant *reply =
+		    registrar_dbus_menu_get_menus_since(self->registrar, generation, serial);
+		g_dbus_method_invocation_return_value(invocation, reply);
 	}
 	else
 	{
-		g_object_unref(invocation);
+		g_dbus_method_invocation_return_error(invocation,
+		                                      G_DBUS_ERROR,
+		                                      G_DBUS_ERROR_UNKNOWN_METHOD,
+		                                      "Unknown method %s",
+		                                      method_name);
 	}
 }
 static const GDBusInterfaceVTable _interface_vtable = { registrar_application_method_call,
 	                                                NULL,
 	                                                NULL };
 
+// Batched changes are sent on the private interface, so listeners opt in to them
+static void registrar_application_on_windows_changed(RegistrarDBusMenu *registrar,
+                                                     GVariant *registered, GVariant *unregistered,
+                                                     gpointer user_data)
+{
+	GApplication *app           = G_APPLICATION(user_data);
+	GDBusConnection *connection = g_application_get_dbus_connection(app);
+	if (connection == NULL)
+		return;
+	g_dbus_connection_emit_signal(connection,
+	                              NULL,
+	                              g_application_get_dbus_object_path(app),
+	                              "org.valapanel.AppMenu.Registrar",
+	                              "WindowsChanged",
+	                              g_variant_new("(@a(uso)@au)", registered, unregistered),
+	                              NULL);
+}
+
 static int registrar_application_dbus_register(GApplication *base, GDBusConnection *connection,
                                                const char *object_path, GError **error)
 {
@@ -150,6 +190,10 @@ static int registrar_application_dbus_register(GApplication *base, GDBusConnecti
 	                                 registrar_application_on_dbus_name_lost,
 	                                 self,
 	                                 NULL);
+	g_signal_connect(self->registrar,
+	                 "windows-changed",
+	                 G_CALLBACK(registrar_application_on_windows_changed),
+	                 self);
 	GDBusNodeInfo *info = g_dbus_node_info_new_for_xml(private_xml, NULL);
 	self->private_binding =
 	    g_dbus_connection_register_object(connection,
@@ -169,6 +213,9 @@ static void registrar_application_dbus_unregister(GApplication *base, GDBusConne
 	g_return_if_fail(connection != NULL);
 	g_return_if_fail(object_path != NULL);
 	g_bus_unown_name(self->dbusmenu_binding);
+	g_signal_handlers_disconnect_by_func(self->registrar,
+	                                     registrar_application_on_windows_changed,
+	                                     self);
 	registrar_dbus_menu_unregister(self->registrar, connection);
 	g_dbus_connection_unregister_object(connection, self->private_binding);
 	self->dbusmenu_binding = 0;
@@ -0,0 +1,190 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Usage: registrar-load-test [--session] [--calls=N]
+ * Sends RegisterWindow and GetMenuForWindow calls in turn, with up to MAX_PENDING calls in
+ * flight, and reports calls per second. By default a registrar object is served in this
+ * process on a private test bus; with --session the registrar running on the session bus is
+ * loaded instead.
+ */
+
+#include "registrar-dbusmenu.h"
+#include <glib/gstdio.h>
+#include <stdbool.h>
+
+#define MAX_PENDING 64
+
+static bool session = false;
+static int n_calls  = 100000;
+
+static GOptionEntry entries[] = {
+	{ "session", 0, 0, G_OPTION_ARG_NONE, &session, "Load the session registrar", NULL },
+	{ "calls", 0, 0, G_OPTION_ARG_INT, &n_calls, "Number of calls", "N" },
+	{ NULL }
+};
+
+typedef struct
+{
+	GDBusConnection *connection;
+	const char *registrar;
+	uint sent;
+	uint done;
+	uint failed;
+} Load;
+
+static void load_send(Load *load);
+
+static void load_reply(GObject *source, GAsyncResult *res, Load *load)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) reply =
+	    g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+	if (reply == NULL)
+	{
+		if (load->failed == 0)
+			g_printerr("%s\n", error->message);
+		load->failed++;
+	}
+	else if (g_variant_is_of_type(reply, G_VARIANT_TYPE("(so)")))
+	{
+		const char *service;
+		g_variant_get(reply, "(&s&o)", &service, NULL);
+		if (g_strcmp0(service, g_dbus_connection_get_unique_name(load->connection)) != 0)
+			load->failed++;
+	}
+	load->done++;
+	load_send(load);
+}
+
+// Calls go in pairs, every window is registered and then looked up
+static void load_send(Load *load)
+{
+	while (load->sent < (uint)n_calls && load->sent - load->done < MAX_PENDING)
+	{
+		uint window_id = load->sent / 2 + 1;
+		bool lookup    = load->sent % 2 == 1;
+		g_autofree char *path =
+		    lookup ? NULL : g_strdup_printf("/com/canonical/menu/%X", window_id);
+		g_dbus_connection_call(load->connection,
+		                       load->registrar,
+		                       DBUSMENU_REG_OBJECT,
+		                       DBUSMENU_REG_IFACE,
+		                       lookup ? "GetMenuForWindow" : "RegisterWindow",
+		                       lookup ? g_variant_new("(u)", window_id)
+		                              : g_variant_new("(uo)", window_id, path),
+		                       lookup ? G_VARIANT_TYPE("(so)") : NULL,
+		                       G_DBUS_CALL_FLAGS_NONE,
+		                       -1,
+		                       NULL,
+		                       (GAsyncReadyCallback)load_reply,
+		                       load);
+		load->sent++;
+	}
+}
+
+static GDBusConnection *connection_new(GError **error)
+{
+	g_autofree char *address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, NULL, error);
+	if (address == NULL)
+		return NULL;
+	return g_dbus_connection_new_for_address_sync(
+	    address,
+	    G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+	        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+	    NULL,
+	    NULL,
+	    error);
+}
+
+static int run_load(const char *registrar)
+{
+	g_autoptr(GError) error = NULL;
+	Load load               = { 0 };
+	load.registrar          = registrar;
+	load.connection         = connection_new(&error);
+	if (load.connection == NULL)
+	{
+		g_printerr("%s\n", error->message);
+		return 1;
+	}
+	gint64 start = g_get_monotonic_time();
+	load_send(&load);
+	while (load.done < (uint)n_calls)
+		g_main_context_iteration(NULL, true);
+	double seconds = (double)(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+	g_print("%u calls in %.2f s: %.0f calls/s, %u failed\n",
+	        load.done,
+	        seconds,
+	        load.done / seconds,
+	        load.failed);
+	g_object_unref(load.connection);
+	return load.failed > 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	g_autoptr(GError) error           = NULL;
+	g_autoptr(GOptionContext) context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error) || n_calls <= 0)
+	{
+		g_printerr("%s\n",
+		           error != NULL ? error->message : "Number of calls must be positive");
+		return 2;
+	}
+	if (session)
+		return run_load(DBUSMENU_REG_IFACE);
+
+	// Registrar saves a snapshot on exit, which must not replace one of the user session
+	g_autofree char *runtime_dir = g_dir_make_tmp("registrar-load-XXXXXX", &error);
+	if (runtime_dir == NULL)
+	{
+		g_printerr("%s\n", error->message);
+		return 1;
+	}
+	g_setenv("XDG_RUNTIME_DIR", runtime_dir, true);
+	GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(bus);
+	GDBusConnection *connection  = connection_new(&error);
+	RegistrarDBusMenu *registrar = g_object_new(registrar_dbus_menu_get_type(), NULL);
+	int ret                      = 1;
+	if (connection != NULL && registrar_dbus_menu_register(registrar, connection, &error) > 0)
+	{
+		ret = run_load(g_dbus_connection_get_unique_name(connection));
+		// Drops the reference as well
+		registrar_dbus_menu_unregister(registrar, connection);
+	}
+	else
+	{
+		g_printerr("%s\n", error->message);
+		g_object_unref(registrar);
+	}
+	g_clear_object(&connection);
+	g_test_dbus_down(bus);
+	g_object_unref(bus);
+
+	g_autoptr(GDir) dir = g_dir_open(runtime_dir, 0, NULL);
+	const char *name;
+	while (dir != NULL && (name = g_dir_read_name(dir)) != NULL)
+	{
+		g_autofree char *path = g_build_filename(runtime_dir, name, NULL);
+		g_unlink(path);
+	}
+	g_rmdir(runtime_dir);
+	return ret;
+}
@@ -0,0 +1,265 @@
+/*
+ * vala-panel-appmenu
+ * Copyright (C) 2018 Konstantin Pugin <ria.freelander@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Registrar snapshots: windows registered with one registrar instance come back in the next
+ * one on the same bus, while a snapshot of another format version, of another bus or with
+ * broken data restores nothing.
+ */
+
+#include "registrar-dbusmenu.h"
+#include <glib/gstdio.h>
+#include <stdbool.h>
+
+#define WINDOW_ID 7
+#define MENU_PATH "/com/canonical/menu/7"
+#define SETTLE_MS 200
+#define DEADLINE_MS 5000
+
+typedef struct
+{
+	GDBusConnection *client;
+	GDBusConnection *connection;
+	RegistrarDBusMenu *registrar;
+	char *snapshot;
+} Fixture;
+
+static GDBusConnection *connection_new(void)
+{
+	g_autoptr(GError) error = NULL;
+	g_autofree char *address =
+	    g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, NULL, &error);
+	g_assert_no_error(error);
+	GDBusConnection *connection = g_dbus_connection_new_for_address_sync(
+	    address,
+	    G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+	        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+	    NULL,
+	    NULL,
+	    &error);
+	g_assert_no_error(error);
+	return connection;
+}
+
+static void registrar_start(Fixture *f)
+{
+	g_autoptr(GError) error = NULL;
+	f->connection           = connection_new();
+	f->registrar            = g_object_new(registrar_dbus_menu_get_type(), NULL);
+	registrar_dbus_menu_register(f->registrar, f->connection, &error);
+	g_assert_no_error(error);
+}
+
+// Unregistering drops the last reference, and the registrar saves pending changes
+static void registrar_stop(Fixture *f)
+{
+	registrar_dbus_menu_unregister(g_steal_pointer(&f->registrar), f->connection);
+	g_clear_object(&f->connection);
+}
+
+static void iterate(uint ms)
+{
+	gint64 start = g_get_monotonic_time();
+	while (g_get_monotonic_time() - start < ms * 1000)
+		if (!g_main_context_iteration(NULL, false))
+			g_usleep(1000);
+}
+
+static const char *menu_of(Fixture *f, uint window_id)
+{
+	guint32 id                  = window_id;
+	g_autoptr(GVariant) windows = g_variant_ref_sink(
+	    g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32, &id, 1, sizeof(id)));
+	g_autoptr(GVariant) menus =
+	    registrar_dbus_menu_get_menus_for_windows(f->registrar, windows);
+	if (g_variant_n_children(menus) == 0)
+		return NULL;
+	g_autoptr(GVariant) entry = g_variant_get_child_value(menus, 0);
+	g_autoptr(GVariant) path  = g_variant_get_child_value(entry, 2);
+	return g_intern_string(g_variant_get_string(path, NULL));
+}
+
+static void on_registered(GObject *source, GAsyncResult *res, bool *done)
+{
+	g_autoptr(GError) error   = NULL;
+	g_autoptr(GVariant) reply =
+	    g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+	g_assert_no_error(error);
+	*done = true;
+}
+
+// Registers a window from the client and saves the snapshot by stopping the registrar
+static void save_window(Fixture *f)
+{
+	bool done = false;
+	registrar_start(f);
+	g_dbus_connection_call(f->client,
+	                       g_dbus_connection_get_unique_name(f->connection),
+	                       DBUSMENU_REG_OBJECT,
+	                       DBUSMENU_REG_IFACE,
+	                       "RegisterWindow",
+	                       g_variant_new("(uo)", WINDOW_ID, MENU_PATH),
+	                       NULL,
+	                       G_DBUS_CALL_FLAGS_NONE,
+	                       -1,
+	                       NULL,
+	                       (GAsyncReadyCallback)on_registered,
+	                       &done);
+	while (!done)
+		g_main_context_iteration(NULL, true);
+	g_assert_cmpstr(menu_of(f, WINDOW_ID), ==, MENU_PATH);
+	registrar_stop(f);
+	g_assert_true(g_file_test(f->snapshot, G_FILE_TEST_IS_REGULAR));
+}
+
+// Starts a registrar and gives it time to check owners of restored windows
+static const char *restore_window(Fixture *f)
+{
+	registrar_start(f);
+	gint64 start = g_get_monotonic_time();
+	while (menu_of(f, WINDOW_ID) == NULL &&
+	       g_get_monotonic_time() - start < (gint64)DEADLINE_MS * 1000)
+		iterate(10);
+	iterate(SETTLE_MS);
+	const char *path = menu_of(f, WINDOW_ID);
+	registrar_stop(f);
+	return path;
+}
+
+static GVariant *read_snapshot(Fixture *f)
+{
+	g_autoptr(GError) error = NULL;
+	g_autofree char *data   = NULL;
+	gsize length;
+	g_file_get_contents(f->snapshot, &data, &length, &error);
+	g_assert_no_error(error);
+	g_autoptr(GBytes) bytes = g_bytes_new_take(g_steal_pointer(&data), length);
+	return g_variant_ref_sink(
+	    g_variant_new_from_bytes(G_VARIANT_TYPE("(usa(uso))"), bytes, false));
+}
+
+static void write_snapshot(Fixture *f, const void *data, gsize length)
+{
+	g_autoptr(GError) error = NULL;
+	g_file_set_contents(f->snapshot, data, (gssize)length, &error);
+	g_assert_no_error(error);
+}
+
+// Replaces version or bus GUID of the saved snapshot, keeping its entries
+static void rewrite_snapshot(Fixture *f, int version_delta, const char *bus_guid)
+{
+	g_autoptr(GVariant) snapshot = read_snapshot(f);
+	uint version;
+	const char *guid;
+	g_autoptr(GVariant) menus = NULL;
+	g_variant_get(snapshot, "(u&s@a(uso))", &version, &guid, &menus);
+	g_assert_cmpuint(g_variant_n_children(menus), ==, 1);
+	g_autoptr(GVariant) rewritten =
+	    g_variant_ref_sink(g_variant_new("(us@a(uso))",
+	                                     version + version_delta,
+	                                     bus_guid != NULL ? bus_guid : guid,
+	                                     menus));
+	g_autoptr(GVariant) normal = g_variant_get_normal_form(rewritten);
+	write_snapshot(f, g_variant_get_data(normal), g_variant_get_size(normal));
+}
+
+static void fixture_setup(Fixture *f, gconstpointer data)
+{
+	f->client             = connection_new();
+	g_autofree char *name = g_strdup_printf("appmenu-registrar-%s.snapshot",
+	                                        g_dbus_connection_get_guid(f->client));
+	f->snapshot           = g_build_filename(g_get_user_runtime_dir(), name, NULL);
+	g_unlink(f->snapshot);
+}
+
+static void fixture_teardown(Fixture *f, gconstpointer data)
+{
+	g_unlink(f->snapshot);
+	g_free(f->snapshot);
+	g_clear_object(&f->client);
+}
+
+static void test_snapshot_round_trip(Fixture *f, gconstpointer data)
+{
+	save_window(f);
+	g_assert_cmpstr(restore_window(f), ==, MENU_PATH);
+}
+
+static void test_snapshot_version_mismatch(Fixture *f, gconstpointer data)
+{
+	save_window(f);
+	rewrite_snapshot(f, 1, NULL);
+	g_assert_null(restore_window(f));
+}
+
+static void test_snapshot_guid_mismatch(Fixture *f, gconstpointer data)
+{
+	save_window(f);
+	rewrite_snapshot(f, 0, "00000000000000000000000000000000");
+	g_assert_null(restore_window(f));
+}
+
+static void test_snapshot_corrupt(Fixture *f, gconstpointer data)
+{
+	save_window(f);
+	g_autoptr(GVariant) snapshot = read_snapshot(f);
+	// Entries end where the file is cut
+	write_snapshot(f, g_variant_get_data(snapshot), g_variant_get_size(snapshot) / 2);
+	g_assert_null(restore_window(f));
+	const char garbage[] = "\xff\x00 not a snapshot \x01\x02\x03";
+	write_snapshot(f, garbage, sizeof(garbage));
+	g_assert_null(restore_window(f));
+}
+
+int main(int argc, char **argv)
+{
+	// Runtime directory is read once, before anything asks for it
+	g_autofree char *runtime_dir = g_dir_make_tmp("registrar-snapshot-XXXXXX", NULL);
+	g_assert_nonnull(runtime_dir);
+	g_setenv("XDG_RUNTIME_DIR", runtime_dir, true);
+	g_test_init(&argc, &argv, NULL);
+	g_test_add("/snapshot/round-trip",
+	           Fixture,
+	           NULL,
+	           fixture_setup,
+	           test_snapshot_round_trip,
+	           fixture_teardown);
+	g_test_add("/snapshot/version-mismatch",
+	           Fixture,
+	           NULL,
+	           fixture_setup,
+	           test_snapshot_version_mismatch,
+	           fixture_teardown);
+	g_test_add("/snapshot/guid-mismatch",
+	           Fixture,
+	           NULL,
+	           fixture_setup,
+	           test_snapshot_guid_mismatch,
+	           fixture_teardown);
+	g_test_add("/snapshot/corrupt",
+	           Fixture,
+	           NULL,
+	           fixture_setup,
+	           test_snapshot_corrupt,
+	           fixture_teardown);
+	g_autoptr(GTestDBus) bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(bus);
+	int ret = g_test_run();
+	g_test_dbus_down(bus);
+	g_rmdir(runtime_dir);
+	return ret;
+}